@@ -0,0 +1,200 @@
+#ifndef FINDBALLEXP_COORDINATOR_H_
+#define FINDBALLEXP_COORDINATOR_H_
+
+#include "InstancePool.h"
+#include "ResultWriter.h"
+#include "TestQueue.h"
+#include "WorkerLink.h"
+#include "utils/EventLoop.h"
+#include "utils/ThreadSafeLogger.h"
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+using namespace librcsscontroller;
+
+namespace findballexp
+{
+    /**
+     *  Coordinator runs each lane in a worker process of its own, so a lane
+     *  that crashes or hangs cannot take the others down with it.
+     *
+     *  The coordinator owns the TestQueue and ResultWriter. Workers take
+     *  tests and hand back results over a WorkerLink. When a worker dies, or
+     *  stops sending heartbeats for STALL_TIMEOUT_MS, it is killed, the test
+     *  it was running is requeued and the lane is respawned. A lane that
+     *  fails MAX_FAILURES times in a row without finishing a test is retired.
+     *
+     *  With an InstancePool, each worker runs on a warm instance taken from
+     *  the pool, and a worker that dies hands its instance back to be
+     *  replaced. Its respawn takes another warm instance.
+     *
+     *  Workers are forked, so the coordinator must not start any threads of
+     *  its own before Run().
+     */
+    class Coordinator
+    {
+    public:
+        /**< Runs a lane on a slot's ports in a worker process, returning its
+         *   exit code */
+        typedef std::function<int(int slot, WorkerLink& link)> LaneFunction;
+
+        /**
+         *  Constructor
+         *
+         *  @param tests Queue to hand tests out from
+         *  @param results Writer to write test results to
+         *  @param loop Event loop to wait on workers with
+         *  @param stopping Set once SIGINT is received, to stop every worker
+         *  @param pool Pool to run workers on instances from, or nullptr to
+         *  run lane k on slot k
+         */
+        Coordinator(TestQueue& tests, ResultWriter& results, EventLoop& loop,
+                    const std::atomic<bool>& stopping, 
+                    InstancePool* pool = nullptr);
+
+        /**
+         *  Deconstructor. Kills any workers still running.
+         */
+        ~Coordinator();
+
+        /**
+         *  Runs every lane in a worker process until all have finished, and
+         *  respawns those that die.
+         *
+         *  @param num_lanes The number of lanes to run.
+         *  @param lane_function Runs a lane in a worker process.
+         *  @return bool True indicates success. False indicates a lane was
+         *  retired.
+         */
+        bool Run(const int num_lanes, LaneFunction lane_function);
+
+        /**
+         *  How long a worker may go without sending a message before it is
+         *  considered stalled.
+         */
+        constexpr static int STALL_TIMEOUT_MS = 30000;
+
+        /**
+         *  How long to wait before respawning a lane, so its ports are freed.
+         */
+        constexpr static int RESPAWN_DELAY_MS = 1000;
+
+        /**
+         *  How often workers are checked for stalls and respawns, and the
+         *  pool is health-checked.
+         */
+        constexpr static int CHECK_INTERVAL_MS = 1000;
+
+        /**
+         *  How many times in a row a lane may fail before it is retired.
+         */
+        constexpr static int MAX_FAILURES = 3;
+
+    private:
+        /**
+         *  The state of a lane's worker.
+         */
+        enum WorkerState
+        {
+            RUNNING,    /**< The worker process is running */
+            WAITING,    /**< The worker died, and is waiting to be respawned */
+            FINISHED,   /**< The worker ran out of tests, or was stopped */
+            RETIRED     /**< The worker failed too many times */
+        };
+
+        /**
+         *  A lane's worker process.
+         */
+        struct Worker
+        {
+            int lane;               /**< The lane the worker runs */
+            int slot;               /**< The slot whose ports it runs on */
+            WorkerState state;      /**< The worker's state */
+            pid_t pid;              /**< The worker's process id */
+            int fd;                 /**< The coordinator's end of the socket pair */
+            int test;               /**< The index of the test it is running, or -1 */
+            bool done;              /**< Indicates it was told every test is taken */
+            int64_t last_heard;     /**< When it last sent a message, in ms */
+            int64_t respawn_at;     /**< When to respawn it, in ms */
+            int failures;           /**< Deaths in a row without finishing a test */
+        };
+
+        /**
+         *  Forks a worker process for a lane.
+         *
+         *  @param w The lane's worker.
+         *  @return bool True indicates success.
+         */
+        bool Spawn(Worker* w);
+
+        /**
+         *  Handles every message a worker has sent, and reaps it if it has
+         *  exited.
+         *
+         *  @param w The worker.
+         */
+        void Receive(Worker* w);
+
+        /**
+         *  Handles one message from a worker.
+         *
+         *  @param w The worker.
+         *  @param msg The message.
+         *  @param size The size of the message.
+         */
+        void Handle(Worker* w, const char* msg, const size_t size);
+
+        /**
+         *  Collects a worker that has exited or been killed, requeues its
+         *  test and decides whether to respawn it.
+         *
+         *  @param w The worker.
+         */
+        void Reap(Worker* w);
+
+        /**
+         *  Counts a failure of a lane, and schedules it to be respawned or
+         *  retires it.
+         *
+         *  @param w The lane's worker.
+         */
+        void Retry(Worker* w);
+
+        /**
+         *  Kills stalled workers, respawns waiting ones that are due and
+         *  health-checks the pool.
+         */
+        void Check();
+
+        /**
+         *  Sends a message to a worker.
+         *
+         *  @param w The worker.
+         *  @param msg The message.
+         */
+        void Send(Worker* w, const std::string& msg);
+
+        /**
+         *  Returns the monotonic clock in milliseconds.
+         *
+         *  @return int64_t The time in milliseconds.
+         */
+        static int64_t GetClockMs();
+
+        ThreadSafeLogger log_;              /**< Used for logging */
+        TestQueue& tests_;                  /**< Hands out the tests to run */
+        ResultWriter& results_;             /**< Writes test results in order */
+        EventLoop& loop_;                   /**< Wakes when a worker sends a message */
+        const std::atomic<bool>& stopping_; /**< Set once SIGINT is received */
+        InstancePool* pool_;                /**< Supplies instances, or nullptr */
+        LaneFunction lane_function_;        /**< Runs a lane in a worker process */
+        std::vector<Worker> workers_;       /**< The worker of each lane */
+        std::vector<char> buffer_;          /**< Receives worker messages */
+    };
+}
+
+#endif // FINDBALLEXP_COORDINATOR_H_
@@ -3,14 +3,20 @@
 
 #include "agent/AgentServer.h"
 #include "FromRunswiftAgent.h"
+#include "ResultSink.h"
+#include "TestSource.h"
 #include "ToRunswiftAgent.h"
-#include "simulator/SimulatorConnection.h"
-#include "utils/Logger.h"
+#include "simulator/AsyncSimulatorConnection.h"
+#include "utils/EventLoop.h"
+#include "utils/ThreadSafeLogger.h"
 
-#include <time.h>
-#include <fstream>
+#include <chrono>
+#include <cstdint>
 #include <random>
+#include <sstream>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 using namespace librcsscontroller;
 
@@ -24,12 +30,15 @@ namespace findballexp
      *  The ball is placed in locations around the field, and the time it takes
      *  for agents to find the ball is recorded. Data is output in .cvs files
      *  which can be used for data mining and visualisation.
+     *
+     *  Each FindBallExperiment drives one simulator and its agents. Several
+     *  may run side by side, taking tests from a shared TestSource and
+     *  writing their results to a shared ResultSink.
      */
     class FindBallExperiment
     {
     public:
         /**< The AgentServer used by rUNSWift agents */
-
         typedef AgentServer<FromRunswiftAgent, ToRunswiftAgent> RunswiftAgentServer;
         /**< Represents a point on the field */
         typedef std::pair<float, float> Point;
@@ -39,11 +48,18 @@ namespace findballexp
          * 
          *  @param simulator Connection to the simulator to use
          *  @param agent_server Agent server to communicate with agents
-         *  @param start_from The test number to start from
+         *  @param loop Event loop to schedule ticks with
+         *  @param tests Queue to take the tests to run from
+         *  @param results Writer to write test results to
+         *  @param sync_mode Indicates the simulator runs in sync mode, so
+         *  all timing uses simulator time instead of wall-clock time
          */
-        FindBallExperiment(SimulatorConnection& simulator
+        FindBallExperiment(AsyncSimulatorConnection& simulator
                 , RunswiftAgentServer& agent_server
-                , const int start_from);
+                , EventLoop& loop
+                , TestSource& tests
+                , ResultSink& results
+                , const bool sync_mode = false);
         
         /**
          *  Deconstructor
@@ -60,7 +76,8 @@ namespace findballexp
         /**
          *  Updates experiment
          *
-         *  @return bool True indicates success. False indicates error.
+         *  @return bool True indicates success. False indicates every test 
+         *  in the queue has been run.
          */
         bool Tick();
 
@@ -71,6 +88,13 @@ namespace findballexp
          */        
         bool Finish();
 
+        /**
+         *  Abandons the current test without recording it, and hands it back
+         *  to be run again. Used when the simulator is lost mid-test, or an
+         *  agent joins during one.
+         */
+        void Abort();
+
     private:
         /**< How long in seconds the robots have to find the ball before timeout */
         const static int FIND_BALL_TIMEOUT      = 300;
@@ -81,6 +105,18 @@ namespace findballexp
         /**< The maximum distance (in mm) from the ball before it is considered to be found */
         const static int FIND_BALL_MAX_DIST     = 300;
 
+        /**< How long (in ms) to wait for every agent's robot to appear before starting a test anyway */
+        constexpr static int START_WAIT_MS      = 2000;
+
+        /**< How many simulator messages to give the moves of a new test, if the simulator does not acknowledge them */
+        constexpr static int PREPARE_WAIT_MESSAGES = 150;
+
+        /**< How many simulator messages to give the ball to leave the field, if the simulator does not acknowledge it */
+        constexpr static int RESET_WAIT_MESSAGES = 150;
+
+        /**< The team the agents play on. The starting positions are in its half */
+        constexpr static std::string_view AGENT_TEAM = "Left";
+
         /**< Number of unique ball positions to use */
         const static int UNIQUE_POINTS          = 10;
 
@@ -103,6 +139,20 @@ namespace findballexp
          */
         enum State {NOT_STARTED, TEST_STARTING, TEST_STARTED, TEST_FINISHED};
 
+        /**
+         *  The result of checking an agent's update for the ball, kept so 
+         *  the check is only repeated when the agent sends a new update.
+         */
+        struct BallCheck
+        {
+            BallCheck()
+                : sequence{0}, sees_ball{false}
+            { }
+
+            uint64_t sequence;      /**< The sequence number of the checked update */
+            bool sees_ball;         /**< Indicates the update reports seeing the ball */
+        };
+
         /**
          *  Called each tick during NOT_STARTED states  
          *
@@ -155,11 +205,11 @@ namespace findballexp
         /**
          *  Finish an experiment.
          *
-         *  @param time The time the experiment finished
+         *  @param time_ms The time in ms the experiment took
          *  @param found_by A list of agents who found the ball
          *  @return bool True indicates success. False indicates error.
          */        
-        bool FinishExperiment(int time, const std::vector<Agent>& found_by);
+        bool FinishExperiment(int time_ms, const std::vector<Agent>& found_by);
 
         /**
          *  Cancels the current experiment.
@@ -182,7 +232,7 @@ namespace findballexp
         bool CheckSimulatorGameState();
 
         /**
-         *  Logs the estimated positions of robots for that second.
+         *  Logs the estimated and true positions of robots for that second.
          *
          *  @return bool True indicates success. False indicates error.
          */  
@@ -204,11 +254,27 @@ namespace findballexp
         bool HasNewAgent();
 
         /**
-         *  Gets the current timer seconds.
+         *  Gets the time since the timer was reset.
          *
-         *  @return int The current timer seconds.
+         *  @return int The time since the timer was reset, in ms.
          */
-        int  GetTimerSeconds();
+        int  GetTimerMs();
+
+        /**
+         *  Reads the experiment's clock: simulator time in sync mode, and a
+         *  monotonic wall clock otherwise.
+         *
+         *  @return int64_t The current time in ms, from an arbitrary epoch.
+         */
+        int64_t GetClockMs();
+
+        /**
+         *  Formats a time as seconds with millisecond precision.
+         *
+         *  @param time_ms The time to format, in ms.
+         *  @return std::string The time in seconds, for example "2.031".
+         */
+        static std::string FormatSeconds(int time_ms);
 
         /**
          *  Indicates if an agent has found the ball.
@@ -217,7 +283,17 @@ namespace findballexp
          *  finder(s).
          *  @return bool True indicates ball found.
          */              
-        bool IsBallFound(std::vector<Agent>* found_by);   
+        bool IsBallFound(std::vector<Agent>* found_by);
+
+        /**
+         *  Returns the distance from an agent's robot to the ball, using the
+         *  true poses from the simulator.
+         *
+         *  @param update The agent's last update.
+         *  @return float The distance in mm. Falls back to the agent's own 
+         *  estimate if the simulator does not know the robot or ball pose.
+         */
+        float GetBallDistance(const FromRunswiftAgent& update);   
 
         /**
          *  Gets the starting position for a robot.
@@ -239,23 +315,29 @@ namespace findballexp
          */
         std::string StateToString(int s);
 
-        Logger& log_;               /**< Used for logging */
-        SimulatorConnection& simulator_;    /**< Interfaces with rcssserver3d */
+        ThreadSafeLogger log_;      /**< Used for logging */
+        AsyncSimulatorConnection& simulator_; /**< Interfaces with rcssserver3d */
         RunswiftAgentServer& agent_server_; /**< Interfaces with rUNSWift agents */
-        const int start_index_;      /**< The test index to start from */
+        EventLoop& loop_;           /**< Schedules ticks that do not wait for the simulator */
+        TestSource& tests_;         /**< Hands out the tests to run */
+        ResultSink& results_;       /**< Writes test results in order */
 
         int state_;                 /**< Current state */
-        std::ofstream tests_file_;  /**< File for test result logging */
-        std::ofstream pos_file_;    /**< File for agent position logging */
-        std::ofstream log_file_;    /**< File for general logging */
-        time_t timer_;              /**< Timer used for timing */
-        int counter_;               /**< Current test number */
+        std::ostringstream test_row_; /**< The current test's row of _test.csv */
+        std::ostringstream pos_rows_; /**< The current test's rows of _pos.csv */
+        bool done_;                 /**< Indicates every test has been handed out */
+        const bool sync_mode_;      /**< Indicates timing uses simulator time */
+        int64_t test_start_;        /**< When the current test started, in clock ms */
+        int counter_;               /**< Current test index */
         int num_agents_;            /**< Current number of agents */
         bool started_;              /**< Indicates test is running */
-        int start_in_;              /**< Indicates how long until test is started */
-        int last_log_;              /**< Indicates how long since agent pos was logged */
+        int64_t start_by_;          /**< When to stop waiting for robots and start anyway, in clock ms */
+        bool commands_sent_;        /**< Indicates this state's simulator commands were queued */
+        uint64_t ack_ticket_;       /**< Acknowledged once this state's commands are applied */
+        int last_log_;              /**< The second of the test agent positions were last logged in */
         std::mt19937 mt_;           /**< Random number generator */
         std::uniform_real_distribution<> dist_; /**< Random number distribution */
+        std::vector<BallCheck> ball_checks_; /**< Ball checks, indexed by agent id */
 
     };
 }
@@ -2,14 +2,17 @@
 #define FINDBALLEXP_RUNSWIFTAGENTUPDATE_H_
 
 #include "agent/FromAgent.h"
-#include "comms/MessageParser.h"
+#include "comms/LittleEndian.h"
+#include "comms/MessageSchema.h"
 
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <string>
 
 namespace findballexp
 {
-    struct FromRunswiftAgent 
+    struct FromRunswiftAgent final
         : public librcsscontroller::FromAgent
     {
         int team_number;
@@ -23,6 +26,46 @@ namespace findballexp
         float estimated_orientation; // from localisation
         float dist_from_ball;     // in mm
 
+        // Binary wire format: fixed layout, all fields little-endian.
+        // team_name is NUL padded, and longer names are truncated.
+        const static size_t TEAM_NAME_LENGTH = 16;
+
+#pragma pack(push, 1)
+        struct Binary
+        {
+            int32_t team_number;
+            char team_name[TEAM_NAME_LENGTH];
+            int32_t player_number;
+            uint8_t can_see_ball;
+            int32_t ball_seen_count;
+            int32_t ball_lost_count;
+            float estimated_x_pos;
+            float estimated_y_pos;
+            float estimated_orientation;
+            float dist_from_ball;
+        };
+#pragma pack(pop)
+
+        // Text wire format. Fields may arrive in any order, and unknown keys
+        // are skipped.
+        static const auto& Schema()
+        {
+            using librcsscontroller::MakeField;
+
+            constexpr static auto schema = librcsscontroller::MakeMessageSchema(
+                MakeField("team_number", &FromRunswiftAgent::team_number),
+                MakeField("team_name", &FromRunswiftAgent::team_name),
+                MakeField("player_number", &FromRunswiftAgent::player_number),
+                MakeField("can_see_ball", &FromRunswiftAgent::can_see_ball),
+                MakeField("ball_seen_count", &FromRunswiftAgent::ball_seen_count),
+                MakeField("ball_lost_count", &FromRunswiftAgent::ball_lost_count),
+                MakeField("estimated_x_pos", &FromRunswiftAgent::estimated_x_pos),
+                MakeField("estimated_y_pos", &FromRunswiftAgent::estimated_y_pos),
+                MakeField("estimated_orientation", &FromRunswiftAgent::estimated_orientation),
+                MakeField("dist_from_ball", &FromRunswiftAgent::dist_from_ball));
+            return schema;
+        }
+
         FromRunswiftAgent()
             : team_number(-1), team_name("none"), player_number(-1), can_see_ball(false),
             ball_seen_count(-1), ball_lost_count(-1), estimated_x_pos(-1), estimated_y_pos(-1),
@@ -32,112 +75,65 @@ namespace findballexp
 
         std::string ToMessage() const
         {
-            std::stringstream ret;
-            ret << "("
-                << "(team_number " << team_number << ")"
-                << "(team_name " << team_name << ")"
-                << "(player_number " << player_number << ")"
-                << "(can_see_ball " << (can_see_ball ? "1" : "0") << ")"
-                << "(ball_seen_count " << ball_seen_count << ")"
-                << "(ball_lost_count " << ball_lost_count << ")"
-                << "(estimated_x_pos " << estimated_x_pos << ")"
-                << "(estimated_y_pos " << estimated_y_pos << ")"
-                << "(estimated_orientation " << estimated_orientation << ")"
-                << "(dist_from_ball " << dist_from_ball << ")"
-                << ")";
-            return ret.str();
+            std::string ret;
+            Schema().Encode(*this, &ret);
+            return ret;
         }
 
         virtual bool FromMessage(const std::string& received)
-        {          
-            librcsscontroller::MessageParser msg(received);
-
-            // Opening parenthesis
-            if (!msg.ReadOpen())
-            {
-                std::cerr << "Malformed packet: missing starting parenthesis\n";
-                return false;
-            }
-
-            // team_number
-            if (!msg.ReadKeyVal("team_number", &team_number))
-            {
-                std::cerr << "Malformed packet: error reading team_number\n";
-                return false;
-            }
-
-            // team_name
-            if (!msg.ReadKeyVal("team_name", &team_name))
-            {
-                std::cerr << "Malformed packet: error reading team_name\n";
-                return false;
-            }
-
-            // player_number
-            if (!msg.ReadKeyVal("player_number", &player_number))
-            {
-                std::cerr << "Malformed packet: error reading player_number\n";
-                return false;
-            }
-
-            // can_see_ball
-            if (!msg.ReadKeyVal("can_see_ball", &can_see_ball))
-            {
-                std::cerr << "Malformed packet: error reading can_see_ball\n";
-                return false;
-            }
-
-            // ball_seen_count
-            if (!msg.ReadKeyVal("ball_seen_count", &ball_seen_count))
-            {
-                std::cerr << "Malformed packet: error reading ball_seen_count\n";
-                return false;
-            }
-
-            // ball_lost_count
-            if (!msg.ReadKeyVal("ball_lost_count", &ball_lost_count))
-            {
-                std::cerr << "Malformed packet: error reading ball_lost_count\n";
-                return false;
-            }
-
-            // estimated_x_pos
-            if (!msg.ReadKeyVal("estimated_x_pos", &estimated_x_pos))
+        {
+            if (!Schema().Decode(received, this))
             {
-                std::cerr << "Malformed packet: error reading estimated_x_pos\n";
+                std::cerr << "Malformed packet: \"" << received << "\"\n";
                 return false;
             }
+            return true;
+        }
 
-            // estimated_y_pos
-            if (!msg.ReadKeyVal("estimated_y_pos", &estimated_y_pos))
-            {
-                std::cerr << "Malformed packet: error reading estimated_y_pos\n";
-                return false;
-            }
+        virtual bool ToBinary(std::string* out) const
+        {
+            using librcsscontroller::LittleEndian;
+
+            Binary b;
+            b.team_number = LittleEndian<int32_t>(team_number);
+            std::memset(b.team_name, 0, sizeof(b.team_name));
+            team_name.copy(b.team_name, sizeof(b.team_name));
+            b.player_number = LittleEndian<int32_t>(player_number);
+            b.can_see_ball = can_see_ball ? 1 : 0;
+            b.ball_seen_count = LittleEndian<int32_t>(ball_seen_count);
+            b.ball_lost_count = LittleEndian<int32_t>(ball_lost_count);
+            b.estimated_x_pos = LittleEndian(estimated_x_pos);
+            b.estimated_y_pos = LittleEndian(estimated_y_pos);
+            b.estimated_orientation = LittleEndian(estimated_orientation);
+            b.dist_from_ball = LittleEndian(dist_from_ball);
+
+            out->assign(reinterpret_cast<const char*>(&b), sizeof(b));
+            return true;
+        }
 
-            // estimated_orientation
-            if (!msg.ReadKeyVal("estimated_orientation", &estimated_orientation))
-            {
-                std::cerr << "Malformed packet: error reading estimated_orientation\n";
-                return false;
-            }
+        virtual bool FromBinary(const char* data, size_t size)
+        {
+            using librcsscontroller::LittleEndian;
 
-            // dist_from_ball
-            if (!msg.ReadKeyVal("dist_from_ball", &dist_from_ball))
+            if (size != sizeof(Binary))
             {
-                std::cerr << "Malformed packet: error reading dist_from_ball\n";
+                std::cerr << "Malformed packet: expected " << sizeof(Binary) 
+                          << " bytes, received " << size << "\n";
                 return false;
             }
 
-            // Closing parenthesis
-            if (!msg.ReadClose())
-            {
-                std::cerr << "Malformed packet: error reading closing parenthesis\n";
-                std::string next;
-                msg.ReadVal<std::string>(&next);
-                std::cerr << "Next token: \"" << next << "\"\n";
-                return false;
-            }
+            Binary b;
+            std::memcpy(&b, data, sizeof(b));
+            team_number = LittleEndian<int32_t>(b.team_number);
+            team_name.assign(b.team_name, strnlen(b.team_name, sizeof(b.team_name)));
+            player_number = LittleEndian<int32_t>(b.player_number);
+            can_see_ball = b.can_see_ball != 0;
+            ball_seen_count = LittleEndian<int32_t>(b.ball_seen_count);
+            ball_lost_count = LittleEndian<int32_t>(b.ball_lost_count);
+            estimated_x_pos = LittleEndian<float>(b.estimated_x_pos);
+            estimated_y_pos = LittleEndian<float>(b.estimated_y_pos);
+            estimated_orientation = LittleEndian<float>(b.estimated_orientation);
+            dist_from_ball = LittleEndian<float>(b.dist_from_ball);
             return true;
         }
     };
@@ -0,0 +1,244 @@
+#ifndef FINDBALLEXP_INSTANCEPOOL_H_
+#define FINDBALLEXP_INSTANCEPOOL_H_
+
+#include "Lane.h"
+#include "utils/ThreadSafeLogger.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+using namespace librcsscontroller;
+
+namespace findballexp
+{
+    /**
+     *  InstancePool starts and supervises the simulators and agents that
+     *  lanes run on, so they no longer have to be started by hand.
+     *
+     *  An instance is one rcssserver3d and its agents, on the ports of one
+     *  slot (see Lane). The pool keeps more instances than lanes, so that
+     *  spares are already warm: the simulator accepts monitors and every
+     *  agent has had time to connect to it. When a lane loses its instance,
+     *  it takes a warm spare straight away. The failed instance is killed
+     *  and cold-started again in the background.
+     *
+     *  Commands are run with /bin/sh, after replacing these placeholders
+     *  with the slot's values: {slot}, {monitor_port},
+     *  {simulator_agent_port}, {agent_port}, {datagram_port} and, for
+     *  agents, {player}. Each process runs in its own process group, so
+     *  any children it starts are killed along with it. Output goes to
+     *  logs/simulator<slot>.log and logs/agent<slot>_<player>.log.
+     *
+     *  Start() and Check() start processes, so must be called from the same
+     *  thread, which must outlive them. Acquire() and Release() are safe to
+     *  call from any thread.
+     */
+    class InstancePool
+    {
+    public:
+        /**
+         *  What to run in each instance.
+         */
+        struct Config
+        {
+            std::string simulator_command;  /**< Starts the simulator */
+            std::string agent_command;      /**< Starts one agent */
+            int num_agents;                 /**< Agents per instance */
+            int num_spares;                 /**< Warm instances to keep beyond one per lane */
+        };
+
+        /**
+         *  Constructor
+         *
+         *  @param config What to run in each instance.
+         */
+        InstancePool(const Config& config);
+
+        /**
+         *  Deconstructor. Stops every instance.
+         */
+        ~InstancePool();
+
+        /**
+         *  Starts an instance on each of the first slots.
+         *
+         *  @param num_instances The number of instances to run.
+         *  @return bool True indicates success.
+         */
+        bool Start(const int num_instances);
+
+        /**
+         *  Takes a warm instance for a lane to run on.
+         *
+         *  @param slot[out] The location to save the instance's slot to.
+         *  @param timeout_ms How long to wait for an instance to be warm.
+         *  @return bool True indicates an instance was taken. False
+         *  indicates none was warm in time.
+         */
+        bool Acquire(int* slot, const int timeout_ms = 0);
+
+        /**
+         *  Hands an instance back once a lane is done with it.
+         *
+         *  @param slot The instance's slot.
+         *  @param failed Indicates the lane lost the instance, so it must be
+         *  replaced.
+         */
+        void Release(const int slot, const bool failed);
+
+        /**
+         *  Health-checks every instance. Instances that have died, or take
+         *  too long to warm up, are killed and later started again. Should be
+         *  called every CHECK_INTERVAL_MS.
+         */
+        void Check();
+
+        /**
+         *  Indicates whether any instance may still become warm.
+         *
+         *  @return bool False once every slot has failed to start too many
+         *  times in a row.
+         */
+        bool IsAlive();
+
+        /**
+         *  How often Check() should be called.
+         */
+        constexpr static int CHECK_INTERVAL_MS = 1000;
+
+        /**
+         *  How long an instance may take to accept monitors and warm up.
+         */
+        constexpr static int START_TIMEOUT_MS = 30000;
+
+        /**
+         *  How long agents are given to connect to the simulator before the
+         *  instance counts as warm.
+         */
+        constexpr static int AGENT_WARMUP_MS = 3000;
+
+        /**
+         *  How long to wait before starting a failed instance again, so its
+         *  ports are freed.
+         */
+        constexpr static int RESTART_DELAY_MS = 1000;
+
+        /**
+         *  How long processes have to exit on SIGTERM before being killed.
+         */
+        constexpr static int STOP_TIMEOUT_MS = 3000;
+
+        /**
+         *  How many times in a row an instance may fail to warm up before
+         *  its slot is given up on.
+         */
+        constexpr static int MAX_START_FAILURES = 3;
+
+    private:
+        /**
+         *  The state of an instance.
+         */
+        enum InstanceState
+        {
+            COLD,       /**< Not running; started again at restart_at */
+            STARTING,   /**< The simulator is starting */
+            WARMING,    /**< The agents are connecting to the simulator */
+            WARM,       /**< Ready for a lane */
+            GIVEN_UP    /**< Failed to warm up too many times */
+        };
+
+        /**
+         *  One simulator and its agents.
+         */
+        struct Instance
+        {
+            Lane lane;                  /**< The ports of the instance's slot */
+            InstanceState state;        /**< The instance's state */
+            bool in_use;                /**< Indicates a lane is running on it */
+            pid_t simulator;            /**< The simulator's process group, or -1 */
+            std::vector<pid_t> agents;  /**< The agents' process groups */
+            int64_t since;              /**< When the current state began, in ms */
+            int64_t restart_at;         /**< When to start it again, in ms */
+            int start_failures;         /**< Failed starts in a row */
+        };
+
+        /**
+         *  Starts an instance's simulator. Must be called with mutex_ held.
+         *
+         *  @param inst The instance.
+         */
+        void StartSimulator(Instance* inst);
+
+        /**
+         *  Starts an instance's agents. Must be called with mutex_ held.
+         *
+         *  @param inst The instance.
+         */
+        void StartAgents(Instance* inst);
+
+        /**
+         *  Kills an instance's processes, and schedules it to be started
+         *  again. Must be called with mutex_ held.
+         *
+         *  @param inst The instance.
+         *  @param reason Why the instance failed, for logging.
+         */
+        void Fail(Instance* inst, const std::string& reason);
+
+        /**
+         *  Indicates whether every process of an instance is running. Must
+         *  be called with mutex_ held.
+         *
+         *  @param inst The instance.
+         *  @return bool True if no process has exited.
+         */
+        bool IsRunning(Instance* inst);
+
+        /**
+         *  Starts a command in a process group of its own.
+         *
+         *  @param command The command, with placeholders replaced.
+         *  @param log_path The file to append the command's output to.
+         *  @return pid_t The process group, or -1 on failure.
+         */
+        pid_t Spawn(const std::string& command, const std::string& log_path);
+
+        /**
+         *  Replaces the placeholders in a command.
+         *
+         *  @param command The command.
+         *  @param lane The ports of the instance's slot.
+         *  @param player The agent's player number, or 0.
+         *  @return std::string The command to run.
+         */
+        static std::string Expand(std::string command, const Lane& lane,
+                                  const int player);
+
+        /**
+         *  Indicates whether a port on this machine accepts connections.
+         *
+         *  @param port The port.
+         *  @return bool True if a connection was accepted.
+         */
+        static bool IsListening(const int port);
+
+        /**
+         *  Returns the monotonic clock in milliseconds.
+         *
+         *  @return int64_t The time in milliseconds.
+         */
+        static int64_t GetClockMs();
+
+        ThreadSafeLogger log_;              /**< Used for logging */
+        const Config config_;               /**< What to run in each instance */
+        std::mutex mutex_;                  /**< Guards instances_ */
+        std::condition_variable warmed_;    /**< Signalled when an instance is warm */
+        std::vector<Instance> instances_;   /**< The instance of each slot */
+    };
+}
+
+#endif // FINDBALLEXP_INSTANCEPOOL_H_
@@ -0,0 +1,40 @@
+#ifndef FINDBALLEXP_LANE_H_
+#define FINDBALLEXP_LANE_H_
+
+#include <string>
+
+namespace findballexp
+{
+    /**
+     *  The ports and names used by one lane: one simulator, its agents and
+     *  the experiment driving them. Lane 0 uses the default ports and names;
+     *  lane k adds k * PORT_STRIDE to every port and a k suffix to every
+     *  name.
+     */
+    struct Lane
+    {
+        /**< Each lane adds this multiple of its index to every port it uses */
+        constexpr static int PORT_STRIDE = 1000;
+
+        /**< The most lanes that fit within the port range */
+        constexpr static int MAX_LANES = 62;
+
+        /**
+         *  Works out the ports and names of a lane.
+         *
+         *  @param index The lane's index.
+         *  @return Lane The lane's ports and names.
+         */
+        static Lane Make(const int index);
+
+        int index;                  /**< The lane's index */
+        int simulator_port;         /**< The simulator's monitor port */
+        int simulator_agent_port;   /**< The simulator's port for agents to play on */
+        int agent_port;             /**< The port to listen for TCP agents on */
+        int datagram_port;          /**< The port to receive agent datagrams on */
+        std::string unix_path;      /**< The AF_UNIX socket path for local agents */
+        std::string shm_name;       /**< The shared memory name for local agents */
+    };
+}
+
+#endif // FINDBALLEXP_LANE_H_
@@ -0,0 +1,33 @@
+#ifndef FINDBALLEXP_RESULTSINK_H_
+#define FINDBALLEXP_RESULTSINK_H_
+
+#include <string>
+
+namespace findballexp
+{
+    /**
+     *  ResultSink is the interface experiments write test results to. It is
+     *  implemented by ResultWriter within a process, and by WorkerLink in
+     *  worker processes, which send results to a coordinator instead.
+     */
+    class ResultSink
+    {
+    public:
+        /**
+         *  Deconstructor
+         */
+        virtual ~ResultSink() { }
+
+        /**
+         *  Writes the results of a test.
+         *
+         *  @param test The test number
+         *  @param test_row The test's row of _test.csv, including its newline
+         *  @param pos_rows The test's rows of _pos.csv
+         */
+        virtual void Write(const int test, const std::string& test_row, 
+                           const std::string& pos_rows) = 0;
+    };
+}
+
+#endif // FINDBALLEXP_RESULTSINK_H_
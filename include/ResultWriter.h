@@ -0,0 +1,84 @@
+#ifndef FINDBALLEXP_RESULTWRITER_H_
+#define FINDBALLEXP_RESULTWRITER_H_
+
+#include "ResultSink.h"
+#include "utils/ThreadSafeLogger.h"
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+using namespace librcsscontroller;
+
+namespace findballexp
+{
+    /**
+     *  ResultWriter writes the results of every lane's tests to one
+     *  _test.csv and _pos.csv pair, in test order.
+     *
+     *  Lanes finish tests out of order, and a test requeued when a new agent
+     *  joins finishes after tests queued behind it, so results are held 
+     *  until every earlier test has been written. Results of a test that was
+     *  already passed are written straight away rather than dropped.
+     *  Safe to use from several threads.
+     */
+    class ResultWriter
+        : public ResultSink
+    {
+    public:
+        /**
+         *  Constructor
+         */
+        ResultWriter();
+
+        /**
+         *  Deconstructor. Writes any held results.
+         */
+        ~ResultWriter();
+
+        /**
+         *  Opens the output files and writes their headers.
+         *
+         *  @param prefix The prefix of the output file names
+         *  @param first_test The number of the first test to be written
+         *  @return bool True indicates success. False indicates error.
+         */
+        bool Open(const std::string& prefix, const int first_test);
+
+        /**
+         *  Writes the results of a test, once every earlier test has been
+         *  written.
+         *
+         *  @param test The test number
+         *  @param test_row The test's row of _test.csv, including its newline
+         *  @param pos_rows The test's rows of _pos.csv
+         */
+        void Write(const int test, const std::string& test_row, 
+                   const std::string& pos_rows) override;
+
+        /**
+         *  Writes any held results, in test order, and closes the files.
+         */
+        void Close();
+
+    private:
+        /**
+         *  Writes results to the files. Must be called with mutex_ held.
+         *
+         *  @param test_row The test's row of _test.csv
+         *  @param pos_rows The test's rows of _pos.csv
+         */
+        void WriteRows(const std::string& test_row, const std::string& pos_rows);
+
+        ThreadSafeLogger log_;      /**< Used for logging */
+        std::mutex mutex_;          /**< Guards the files and held results */
+        std::ofstream tests_file_;  /**< File for test result logging */
+        std::ofstream pos_file_;    /**< File for agent position logging */
+        int next_;                  /**< The next test number to be written */
+        std::map<int, std::pair<std::string, std::string>> held_; /**< Results waiting for earlier tests, by test number */
+    };
+}
+
+#endif // FINDBALLEXP_RESULTWRITER_H_
@@ -0,0 +1,54 @@
+#ifndef FINDBALLEXP_TESTQUEUE_H_
+#define FINDBALLEXP_TESTQUEUE_H_
+
+#include "TestSource.h"
+
+#include <mutex>
+#include <set>
+
+namespace findballexp
+{
+    /**
+     *  TestQueue hands out test indices to the experiments of every lane, so
+     *  each test in a sweep is run once no matter how many lanes share it.
+     *  Indices are handed out in increasing order, except that requeued
+     *  tests are handed out again first. Safe to use from several threads.
+     */
+    class TestQueue
+        : public TestSource
+    {
+    public:
+        /**
+         *  Constructor
+         *
+         *  @param first The index of the first test
+         *  @param count The number of tests to run, or -1 to run until stopped
+         */
+        TestQueue(const int first, const int count);
+
+        /**
+         *  Takes the next test to run.
+         *
+         *  @param index[out] The location to save the test index to.
+         *  @return bool True indicates a test was taken. False indicates 
+         *  every test has been handed out.
+         */
+        bool Next(int* index) override;
+
+        /**
+         *  Hands out a test again, because the lane running it abandoned it
+         *  or was lost.
+         *
+         *  @param index The index of the test.
+         */
+        void Requeue(const int index) override;
+
+    private:
+        std::mutex mutex_;          /**< Guards next_ and requeued_ */
+        const int end_;             /**< One past the index of the last test, or -1 */
+        int next_;                  /**< The index of the next test to hand out */
+        std::set<int> requeued_;    /**< Tests to hand out again before next_ */
+    };
+}
+
+#endif // FINDBALLEXP_TESTQUEUE_H_
@@ -0,0 +1,38 @@
+#ifndef FINDBALLEXP_TESTSOURCE_H_
+#define FINDBALLEXP_TESTSOURCE_H_
+
+namespace findballexp
+{
+    /**
+     *  TestSource is the interface experiments take their tests from. It is
+     *  implemented by TestQueue within a process, and by WorkerLink in
+     *  worker processes, which ask a coordinator instead.
+     */
+    class TestSource
+    {
+    public:
+        /**
+         *  Deconstructor
+         */
+        virtual ~TestSource() { }
+
+        /**
+         *  Takes the next test to run.
+         *
+         *  @param index[out] The location to save the test index to.
+         *  @return bool True indicates a test was taken. False indicates 
+         *  every test has been handed out.
+         */
+        virtual bool Next(int* index) = 0;
+
+        /**
+         *  Hands out a test again, because the lane running it abandoned it
+         *  or was lost.
+         *
+         *  @param index The index of the test.
+         */
+        virtual void Requeue(const int index) = 0;
+    };
+}
+
+#endif // FINDBALLEXP_TESTSOURCE_H_
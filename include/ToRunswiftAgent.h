@@ -2,62 +2,91 @@
 #define FINDBALLEXP_RUNSWIFTSERVERRESPONSE_H_
 
 #include "agent/ToAgent.h"
-#include "comms/MessageParser.h"
+#include "comms/LittleEndian.h"
+#include "comms/MessageSchema.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
 
 namespace findballexp
 {
-    struct ToRunswiftAgent 
+    struct ToRunswiftAgent final
         : public librcsscontroller::ToAgent
     {
         int game_state;
         int penalty;
 
+        // Binary wire format: fixed layout, all fields little-endian.
+#pragma pack(push, 1)
+        struct Binary
+        {
+            int32_t game_state;
+            int32_t penalty;
+        };
+#pragma pack(pop)
+
+        // Text wire format. Fields may arrive in any order, and unknown keys
+        // are skipped.
+        static const auto& Schema()
+        {
+            using librcsscontroller::MakeField;
+
+            constexpr static auto schema = librcsscontroller::MakeMessageSchema(
+                MakeField("game_state", &ToRunswiftAgent::game_state),
+                MakeField("penalty", &ToRunswiftAgent::penalty));
+            return schema;
+        }
+
         ToRunswiftAgent()
             : game_state(0), penalty(0)
         { }
 
         virtual std::string ToMessage() const
         {
-            std::stringstream ss;
-            ss << "(";
-            ss << "(game_state " <<  game_state << ")";
-            ss << "(penalty " << penalty << ")";
-            ss << ")";
-            return ss.str();
+            std::string ret;
+            Schema().Encode(*this, &ret);
+            return ret;
         }
 
         virtual bool FromMessage(const std::string& received)
         {
-            librcsscontroller::MessageParser msg(received);
-
-            // Opening parenthesis
-            if (!msg.ReadOpen())
+            if (!Schema().Decode(received, this))
             {
-                std::cerr << "Malformed packet: missing starting parenthesis\n";
+                std::cerr << "Malformed packet: \"" << received << "\"\n";
                 return false;
             }
+            return true;
+        }
 
-            // game_state
-            if (!msg.ReadKeyVal("game_state", &game_state))
-            {
-                std::cerr << "Malformed packet: error reading game_state\n";
-                return false;
-            }            
+        virtual bool ToBinary(std::string* out) const
+        {
+            using librcsscontroller::LittleEndian;
 
-            // penalty
-            if (!msg.ReadKeyVal("penalty", &penalty))
-            {
-                std::cerr << "Malformed packet: error reading penalty\n";
-                return false;
-            }        
+            Binary b;
+            b.game_state = LittleEndian<int32_t>(game_state);
+            b.penalty = LittleEndian<int32_t>(penalty);
+
+            out->assign(reinterpret_cast<const char*>(&b), sizeof(b));
+            return true;
+        }
+
+        virtual bool FromBinary(const char* data, size_t size)
+        {
+            using librcsscontroller::LittleEndian;
 
-            // Closing parenthesis
-            if (!msg.ReadClose())
+            if (size != sizeof(Binary))
             {
-                std::cerr << "Malformed packet: missing starting parenthesis\n";
+                std::cerr << "Malformed packet: expected " << sizeof(Binary) 
+                          << " bytes, received " << size << "\n";
                 return false;
             }
 
+            Binary b;
+            std::memcpy(&b, data, sizeof(b));
+            game_state = LittleEndian<int32_t>(b.game_state);
+            penalty = LittleEndian<int32_t>(b.penalty);
             return true;
         }
     };
@@ -0,0 +1,101 @@
+#ifndef FINDBALLEXP_WORKERLINK_H_
+#define FINDBALLEXP_WORKERLINK_H_
+
+#include "ResultSink.h"
+#include "TestSource.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace findballexp
+{
+    /**
+     *  WorkerLink is a worker process's end of its socket to the
+     *  Coordinator. It stands in for the coordinator's TestQueue and
+     *  ResultWriter, so a lane runs the same in a worker process as on a
+     *  thread.
+     *
+     *  Each message is one SOCK_SEQPACKET packet starting with a letter:
+     *  - N: ask for the next test. Answered with T<index>, or D when every
+     *    test has been handed out.
+     *  - Q<index>: requeue a test the worker could not finish.
+     *  - H: heartbeat, showing the worker has not stalled.
+     *  - W<test> <length>, then a newline: the results of a test. The test
+     *    row of the given length follows, then the position rows.
+     */
+    class WorkerLink
+        : public TestSource
+        , public ResultSink
+    {
+    public:
+        /**
+         *  Constructor
+         *
+         *  @param fd The worker's end of the socket pair. Closed by the link.
+         */
+        explicit WorkerLink(const int fd);
+
+        /**
+         *  Deconstructor. Closes the socket.
+         */
+        ~WorkerLink();
+
+        /**
+         *  Asks the coordinator for the next test to run. Blocks until it
+         *  answers.
+         *
+         *  @param index[out] The location to save the test index to.
+         *  @return bool True indicates a test was taken. False indicates 
+         *  every test has been handed out, or the coordinator is gone.
+         */
+        bool Next(int* index) override;
+
+        /**
+         *  Asks the coordinator to hand a test out again.
+         *
+         *  @param index The index of the test.
+         */
+        void Requeue(const int index) override;
+
+        /**
+         *  Sends the results of a test to the coordinator.
+         *
+         *  @param test The test number
+         *  @param test_row The test's row of _test.csv, including its newline
+         *  @param pos_rows The test's rows of _pos.csv
+         */
+        void Write(const int test, const std::string& test_row, 
+                   const std::string& pos_rows) override;
+
+        /**
+         *  Tells the coordinator the worker is still making progress. Cheap
+         *  enough to call every tick; at most one heartbeat is sent per
+         *  HEARTBEAT_INTERVAL_MS.
+         */
+        void Heartbeat();
+
+        /**
+         *  The shortest time between heartbeats.
+         */
+        constexpr static int HEARTBEAT_INTERVAL_MS = 1000;
+
+        /**
+         *  The largest message either end sends.
+         */
+        constexpr static int MAX_MESSAGE = 1 << 20;
+
+    private:
+        /**
+         *  Sends one message.
+         *
+         *  @param msg The message to send.
+         *  @return bool True indicates success.
+         */
+        bool Send(const std::string& msg);
+
+        const int fd_;              /**< The worker's end of the socket pair */
+        int64_t last_heartbeat_;    /**< When the last heartbeat was sent, in ms */
+    };
+}
+
+#endif // FINDBALLEXP_WORKERLINK_H_
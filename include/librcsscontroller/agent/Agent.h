@@ -25,11 +25,16 @@ namespace librcsscontroller
     struct Agent
     {
     public:
-        Agent(int id)
-            : id{id}
+        Agent()
+            : id{-1}, generation{0}
+        { }
+
+        Agent(int id, unsigned int generation = 0)
+            : id{id}, generation{generation}
         { }
 
         int id;
+        unsigned int generation;    /**< Distinguishes agents that reused an id */
     };
 
 }
@@ -21,28 +21,72 @@
 #define LIBRCSSCONTROLLER_AGENTCONNECTION_H_
 
 #include "comms/EndpointConnection.h"
+#include "comms/FrameBuffer.h"
 #include "comms/MessageParser.h"
+#include "comms/SharedMemoryChannel.h"
 #include "FromAgent.h"
+#include "SendPolicy.h"
 #include "ToAgent.h"
 
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
+#include <vector>
 
 namespace librcsscontroller 
 {
     /**
-     *  The AgentConnection class facilitates a TCP connection with agents.
+     *  The AgentConnection class facilitates a connection with agents, either
+     *  over a stream socket (TCP or AF_UNIX), as datagrams on a shared UDP
+     *  socket, or through a SharedMemoryChannel.
      *  Agents are expected to send TFromAgent instances, and will receieve
      *  TToAgent instances.
      *
      *  @tparam TFromAgent The type that is expected to be received from
      *  agents. 
      *  @tparam TToAgent The type that will be sent to agents.
+     *
+     *  Updates are exchanged as s-expressions by default. An agent can ask
+     *  for the binary format (see ToAgent::ToBinary()) by sending 
+     *  BINARY_HANDSHAKE as its first message. The connection replies with
+     *  BINARY_HANDSHAKE if both types support the binary format, and with
+     *  TEXT_HANDSHAKE otherwise. Agents that never send the handshake keep
+     *  the s-expression format.
+     *
+     *  Each datagram carries a single message, preceded by a 4-byte 
+     *  big-endian sequence number. Datagrams that are not newer than the 
+     *  last one received are dropped.
+     *
+     *  Writes to stream sockets never block. Messages that cannot be written
+     *  straight away are queued, and written by Flush() once the socket is 
+     *  writable. The SendPolicy bounds the queue.
      */
     template <typename TFromAgent, typename TToAgent>
     class AgentConnection 
     {
     public:
+        /**
+         *  The kinds of connection with an agent.
+         */
+        enum Transport {STREAM, DATAGRAM, SHARED_MEMORY};
+
+        /**
+         *  The message agents send to ask for the binary format, and that 
+         *  is sent back if the binary format is accepted.
+         */
+        constexpr static const char BINARY_HANDSHAKE[] = "(wire_format binary)";
+
+        /**
+         *  The message sent back if the binary format is refused.
+         */
+        constexpr static const char TEXT_HANDSHAKE[] = "(wire_format text)";
+
         /**
          *  Constructor
          */        
@@ -57,22 +101,105 @@ namespace librcsscontroller
         bool Init(const EndpointConnection& ep);
 
         /**
-         *  Attempts to receive a TFromAgent from the agent.
+         *  Initialises a datagram connection with the agent.
          *
-         *  @param[out] out A pointer to a TFromAgent to store the 
-         *  received TFromAgent in.
+         *  @param sockfd The UDP socket shared by datagram connections.
+         *  @param address The address of the agent.
          *  @return bool True indicates success. False indicates failure.
          */
-        bool Receive(TFromAgent* out);
+        bool InitDatagram(const int sockfd, const struct sockaddr_in& address);
 
         /**
-         *  Attempts to send a TToAgent to the agent.
+         *  Initialises a connection with an agent attached to a shared memory
+         *  channel.
          *
-         *  @param update The TToAgent instance to send.
+         *  @param channel The channel the agent is attached to.
+         *  @param id The id of the channel, returned by GetId().
          *  @return bool True indicates success. False indicates failure.
          */
+        bool InitSharedMemory(const SharedMemoryChannel& channel, const int id);
+
+        /**
+         *  Receives every TFromAgent that has fully arrived from the agent.
+         *  This never blocks. Partially received updates are kept until the
+         *  rest of the update arrives in a later call.
+         *
+         *  @param[out] out Received TFromAgent instances are appended to this
+         *  vector, oldest first. Zero, one or many may be appended.
+         *  @return bool True indicates success. False indicates the agent has
+         *  disconnected or sent a malformed update.
+         */
+        bool Receive(std::vector<TFromAgent>* out);
+
+        /**
+         *  Handles a datagram received from the agent on the shared socket. 
+         *  Stale and out-of-order datagrams are dropped.
+         *
+         *  @param data The received datagram.
+         *  @param size The size of the received datagram.
+         *  @param[out] out A received TFromAgent instance is appended to this
+         *  vector, unless the datagram was dropped.
+         *  @return bool True indicates success. False indicates the agent has
+         *  sent a malformed update.
+         */
+        bool ReceiveDatagram(const char* data, const size_t size, 
+            std::vector<TFromAgent>* out);
+
+        /**
+         *  Sets the policy for queueing messages the agent is not ready for.
+         *
+         *  @param policy The policy to use.
+         */
+        void SetSendPolicy(const SendPolicy& policy);
+
+        /**
+         *  Attempts to send a TToAgent to the agent, without blocking.
+         *
+         *  @param update The TToAgent instance to send.
+         *  @return bool True indicates the update was sent or queued. False
+         *  indicates failure, or that the agent should be dropped for falling
+         *  too far behind.
+         */
         bool Send(const TToAgent& update);
 
+        /**
+         *  Attempts to send an already framed message to the agent, without
+         *  blocking.
+         *
+         *  @param frame The framed message to send, as produced by 
+         *  FrameBuffer::Encode().
+         *  @return bool True indicates the frame was sent or queued. False
+         *  indicates failure, or that the agent should be dropped for falling
+         *  too far behind.
+         */
+        bool SendFrame(const std::string& frame);
+
+        /**
+         *  Writes as much queued data as the socket will take, without
+         *  blocking.
+         *
+         *  @return bool True indicates success. False indicates a socket
+         *  error.
+         */
+        bool Flush();
+
+        /**
+         *  Indicates whether queued data is waiting for the socket to become
+         *  writable.
+         *
+         *  @return bool True if data is queued. False otherwise.
+         */
+        bool HasPending() const;
+
+        /**
+         *  Indicates whether the agent has stopped reading, leaving queued
+         *  data unwritten for longer than the SendPolicy allows.
+         *
+         *  @param now The current time.
+         *  @return bool True if the agent has stalled. False otherwise.
+         */
+        bool IsStalled(time_t now) const;
+
         /**
          *  Attempts to close the connection with the agent.
          *
@@ -88,7 +215,108 @@ namespace librcsscontroller
          */
         int GetId() const;
 
+        /**
+         *  Indicates whether the agent has gone too long without sending a
+         *  TFromAgent.
+         *
+         *  @param now The current time.
+         *  @return bool True if the agent has timed out. False otherwise.
+         */
+        bool IsTimedOut(time_t now) const;
+
+        /**
+         *  Indicates whether the agent has negotiated the binary format.
+         *
+         *  @return bool True if updates are exchanged in the binary format.
+         *  False if they are exchanged as s-expressions.
+         */
+        bool IsBinary() const;
+
+        /**
+         *  Returns the kind of connection with the agent.
+         *
+         *  @return Transport The kind of connection.
+         */
+        Transport GetTransport() const;
+
+        /**
+         *  Returns the address of the agent. Only set for datagram 
+         *  connections.
+         *
+         *  @return const struct sockaddr_in& The address of the agent.
+         */
+        const struct sockaddr_in& GetAddress() const;
+
     private:
+        /**
+         *  The size of the sequence number preceding each datagram.
+         */
+        constexpr static size_t SEQUENCE_LEN = 4;
+
+        /**
+         *  Decodes a message received from the agent, negotiating the format
+         *  if it is the first.
+         *
+         *  @param message The received message.
+         *  @param[out] out The decoded TFromAgent is appended to this vector,
+         *  unless the message was a handshake.
+         *  @return bool True indicates success. False indicates a malformed
+         *  update, or a failed handshake reply.
+         */
+        bool Decode(const std::string& message, std::vector<TFromAgent>* out);
+
+        /**
+         *  Sends a message to the agent, over whichever transport is in use.
+         *
+         *  @param message The message to send.
+         *  @param replaceable Indicates a newer message may replace this one
+         *  while it is queued.
+         *  @return bool True indicates success. False indicates failure.
+         */
+        bool SendMessage(const std::string& message, const bool replaceable);
+
+        /**
+         *  Queues a frame for a stream socket and writes what it can. If the
+         *  SendPolicy allows, the frame replaces the last queued frame when
+         *  neither has started to be written.
+         *
+         *  @param frame The frame to queue.
+         *  @param replaceable Indicates a newer frame may replace this one
+         *  while it is queued.
+         *  @return bool True indicates the frame was queued. False indicates
+         *  the queue is full, or a socket error.
+         */
+        bool QueueFrame(const std::string& frame, const bool replaceable);
+
+        /**
+         *  Sends a message to the agent in a datagram, with the next outgoing
+         *  sequence number.
+         *
+         *  @param message The message to send.
+         *  @return bool True indicates the whole datagram was sent. False
+         *  indicates failure.
+         */
+        bool SendDatagram(const std::string& message);
+
+        /**
+         *  Sends an already built datagram to the agent.
+         *
+         *  @param datagram The datagram to send, including space for the 
+         *  sequence number, which is filled in.
+         *  @return bool True indicates the whole datagram was sent. False
+         *  indicates failure.
+         */
+        bool SendDatagramBuffer(std::string& datagram);
+
+        /**
+         *  Replies to an agent asking for the binary format, switching to it
+         *  if both types support it.
+         *
+         *  @return bool True indicates the reply was sent. False indicates
+         *  failure.
+         */
+        bool HandleHandshake();
+
         /**
          *  The time in seconds until an agent is considered to have timed out.
          */
@@ -98,6 +326,109 @@ namespace librcsscontroller
          *  The underlying EndpointConnection with the agent.
          */
         EndpointConnection ep_;
+
+        /**
+         *  Reassembles updates received from the agent.
+         */
+        FrameBuffer in_;
+
+        /**
+         *  Holds frames between receiving and decoding them.
+         */
+        std::vector<std::string> frames_;
+
+        /**
+         *  The time the last TFromAgent was received from the agent.
+         */
+        time_t last_receive_;
+
+        /**
+         *  Indicates the first message from the agent has been received, so
+         *  the format can no longer be negotiated.
+         */
+        bool negotiated_;
+
+        /**
+         *  Indicates updates are exchanged in the binary format.
+         */
+        bool binary_;
+
+        /**
+         *  Holds a binary update being sent, before and after framing.
+         */
+        std::string body_;
+        std::string out_;
+
+        /**
+         *  The kind of connection with the agent.
+         */
+        Transport transport_;
+
+        /**
+         *  The shared UDP socket, for datagram connections.
+         */
+        int sockfd_;
+
+        /**
+         *  The address of the agent, for datagram connections.
+         */
+        struct sockaddr_in address_;
+
+        /**
+         *  Indicates a datagram has been received, so last_sequence_ is set.
+         */
+        bool has_sequence_;
+
+        /**
+         *  The sequence number of the last datagram received.
+         */
+        uint32_t last_sequence_;
+
+        /**
+         *  The sequence number of the last datagram sent.
+         */
+        uint32_t send_sequence_;
+
+        /**
+         *  The channel the agent is attached to, for shared memory 
+         *  connections.
+         */
+        SharedMemoryChannel channel_;
+
+        /**
+         *  The id of the channel, for shared memory connections.
+         */
+        int channel_id_;
+
+        /**
+         *  Decides how queued messages are handled.
+         */
+        SendPolicy policy_;
+
+        /**
+         *  Holds framed messages queued for a stream socket.
+         */
+        std::string outbox_;
+
+        /**
+         *  The number of bytes at the front of outbox_ already written.
+         */
+        size_t outbox_sent_;
+
+        /**
+         *  Where the last queued frame starts in outbox_.
+         */
+        size_t last_frame_start_;
+
+        /**
+         *  Indicates the last queued frame may be replaced.
+         */
+        bool last_frame_replaceable_;
+
+        /**
+         *  The last time queued data was written, or first queued.
+         */
+        time_t last_progress_;
     };
 }
 
@@ -19,54 +19,388 @@
 
 namespace librcsscontroller
 {
+    template <typename TFromAgent, typename TToAgent>
+    constexpr const char AgentConnection<TFromAgent, TToAgent>::BINARY_HANDSHAKE[];
+
+    template <typename TFromAgent, typename TToAgent>
+    constexpr const char AgentConnection<TFromAgent, TToAgent>::TEXT_HANDSHAKE[];
+
     template <typename TFromAgent, typename TToAgent>
     AgentConnection<TFromAgent, TToAgent>::AgentConnection()
-    {  } 
+        : last_receive_{0}, negotiated_{false}, binary_{false}, 
+        transport_{STREAM}, sockfd_{0}, has_sequence_{false}, 
+        last_sequence_{0}, send_sequence_{0}, channel_id_{0}, 
+        outbox_sent_{0}, last_frame_start_{0}, last_frame_replaceable_{false},
+        last_progress_{0}
+    { 
+        std::memset(&address_, 0, sizeof(address_));
+    } 
 
     template <typename TFromAgent, typename TToAgent>
     bool AgentConnection<TFromAgent, TToAgent>::Init(const EndpointConnection& ep)
     {
         ep_ = ep;
+        time(&last_receive_);
+        return true;
     }       
 
     template <typename TFromAgent, typename TToAgent>
-    bool AgentConnection<TFromAgent, TToAgent>::Receive(TFromAgent* out)
+    bool AgentConnection<TFromAgent, TToAgent>::InitDatagram(const int sockfd, 
+        const struct sockaddr_in& address)
     {
-        time_t start, now;
-        time(&start);
-        time(&now);
+        transport_ = DATAGRAM;
+        sockfd_ = sockfd;
+        address_ = address;
+        time(&last_receive_);
+        return true;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::InitSharedMemory(
+        const SharedMemoryChannel& channel, const int id)
+    {
+        transport_ = SHARED_MEMORY;
+        channel_ = channel;
+        channel_id_ = id;
+        time(&last_receive_);
+        return true;
+    }
 
-        std::string recv = ep_.Receive();
-        while (!recv.size() && (difftime(now, start) < RECEIVE_TIMEOUT_SEC))
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::Receive(std::vector<TFromAgent>* out)
+    {
+        if (transport_ == SHARED_MEMORY)
+        {
+            bool received = false;
+            while (channel_.ToController().Read(&body_))
+            {
+                received = true;
+                if (!Decode(body_, out))
+                {
+                    return false;
+                }
+            }
+            if (received)
+            {
+                time(&last_receive_);
+            }
+            return channel_.IsAttached();
+        }
+
+        frames_.clear();
+        bool open = in_.Receive(ep_.GetId(), &frames_);
+
+        for (const auto& f : frames_)
         {
-            recv = ep_.Receive();
-            usleep(10);
-            time(&now);
+            if (!Decode(f, out))
+            {
+                return false;
+            }
         }
-        
-        if (!recv.size())
+
+        if (!frames_.empty())
+        {
+            time(&last_receive_);
+        }
+        return open;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::ReceiveDatagram(
+        const char* data, const size_t size, std::vector<TFromAgent>* out)
+    {
+        if (size < SEQUENCE_LEN)
         {
-            std::cerr << "Client timed out!\n";
             return false;
         }
-        return out->FromMessage(recv);
+
+        uint32_t sequence;
+        std::memcpy(&sequence, data, SEQUENCE_LEN);
+        sequence = ntohl(sequence);
+
+        // Compared as a signed difference so sequence numbers can wrap
+        if (has_sequence_ && 
+            static_cast<int32_t>(sequence - last_sequence_) <= 0)
+        {
+            return true;
+        }
+        has_sequence_ = true;
+        last_sequence_ = sequence;
+        time(&last_receive_);
+
+        body_.assign(data + SEQUENCE_LEN, size - SEQUENCE_LEN);
+        return Decode(body_, out);
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    void AgentConnection<TFromAgent, TToAgent>::SetSendPolicy(const SendPolicy& policy)
+    {
+        policy_ = policy;
     }
 
     template <typename TFromAgent, typename TToAgent>
     bool AgentConnection<TFromAgent, TToAgent>::Send(const TToAgent& update)
     {
-        return ep_.Send(update.ToMessage());
+        if (!binary_)
+        {
+            body_ = update.ToMessage();
+        }
+        else if (!update.ToBinary(&body_))
+        {
+            return false;
+        }
+        return SendMessage(body_, policy_.replace_unsent);
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::SendFrame(const std::string& frame)
+    {
+        // A frame's length prefix is the same size as a datagram's sequence
+        // number, so it is simply overwritten
+        static_assert(FrameBuffer::HEADER_LEN == SEQUENCE_LEN, 
+                      "Frame headers must be overwritable by sequence numbers");
+        if (transport_ == DATAGRAM)
+        {
+            out_ = frame;
+            return SendDatagramBuffer(out_);
+        }
+        // Shared memory rings store their own lengths, so only the message
+        // after the length prefix is written
+        if (transport_ == SHARED_MEMORY)
+        {
+            return channel_.ToAgent().Write(frame.data() + FrameBuffer::HEADER_LEN, 
+                                            frame.size() - FrameBuffer::HEADER_LEN);
+        }
+
+        return QueueFrame(frame, policy_.replace_unsent);
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::Flush()
+    {
+        while (outbox_sent_ < outbox_.size())
+        {
+            ssize_t sent = send(ep_.GetId(), outbox_.data() + outbox_sent_, 
+                                outbox_.size() - outbox_sent_, 
+                                MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                return false;
+            }
+            outbox_sent_ += sent;
+            time(&last_progress_);
+        }
+
+        if (outbox_sent_ == outbox_.size())
+        {
+            outbox_.clear();
+            outbox_sent_ = 0;
+            last_frame_start_ = 0;
+        }
+        else if (outbox_sent_ >= outbox_.size() / 2)
+        {
+            // Drop written data once it is at least half the queue, so the 
+            // queue's storage is reused rather than grown
+            if (last_frame_start_ < outbox_sent_)
+            {
+                last_frame_replaceable_ = false;
+                last_frame_start_ = 0;
+            }
+            else
+            {
+                last_frame_start_ -= outbox_sent_;
+            }
+            outbox_.erase(0, outbox_sent_);
+            outbox_sent_ = 0;
+        }
+        return true;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::HasPending() const
+    {
+        return outbox_sent_ < outbox_.size();
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::IsStalled(time_t now) const
+    {
+        return HasPending() && 
+            difftime(now, last_progress_) >= policy_.max_stall_sec;
     }
 
     template <typename TFromAgent, typename TToAgent>
     bool AgentConnection<TFromAgent, TToAgent>::Close()
     {
+        // The shared socket and channels outlive their connections
+        if (transport_ != STREAM)
+        {
+            return true;
+        }
         return ep_.Close();
     }
 
     template <typename TFromAgent, typename TToAgent>
     int AgentConnection<TFromAgent, TToAgent>::GetId() const
     {
+        if (transport_ == DATAGRAM)
+        {
+            return sockfd_;
+        }
+        if (transport_ == SHARED_MEMORY)
+        {
+            return channel_id_;
+        }
         return ep_.GetId();
     }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::IsTimedOut(time_t now) const
+    {
+        return difftime(now, last_receive_) >= RECEIVE_TIMEOUT_SEC;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::IsBinary() const
+    {
+        return binary_;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    typename AgentConnection<TFromAgent, TToAgent>::Transport 
+        AgentConnection<TFromAgent, TToAgent>::GetTransport() const
+    {
+        return transport_;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    const struct sockaddr_in& AgentConnection<TFromAgent, TToAgent>::GetAddress() const
+    {
+        return address_;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::HandleHandshake()
+    {
+        // The binary format is only accepted if updates can be sent in it,
+        // and agent messages can be read in it. The latter is probed with a
+        // round trip, since the default FromBinary() always fails.
+        std::string probe;
+        bool binary = TToAgent().ToBinary(&probe);
+        probe.clear();
+        binary = binary && TFromAgent().ToBinary(&probe)
+            && TFromAgent().FromBinary(probe.data(), probe.size());
+        std::string reply = binary ? BINARY_HANDSHAKE : TEXT_HANDSHAKE;
+
+        if (!SendMessage(reply, false))
+        {
+            return false;
+        }
+        binary_ = binary;
+        return true;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::Decode(
+        const std::string& message, std::vector<TFromAgent>* out)
+    {
+        if (!negotiated_)
+        {
+            negotiated_ = true;
+            if (message == BINARY_HANDSHAKE)
+            {
+                return HandleHandshake();
+            }
+        }
+
+        TFromAgent update;
+        bool decoded = binary_ ? update.FromBinary(message.data(), message.size()) 
+                               : update.FromMessage(message);
+        if (!decoded)
+        {
+            return false;
+        }
+        out->push_back(update);
+        return true;
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::SendMessage(
+        const std::string& message, const bool replaceable)
+    {
+        switch (transport_)
+        {
+            case DATAGRAM:
+                return SendDatagram(message);
+            case SHARED_MEMORY:
+                return channel_.ToAgent().Write(message.data(), message.size());
+            default:
+                FrameBuffer::Encode(message, &out_);
+                return QueueFrame(out_, replaceable);
+        }
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::QueueFrame(
+        const std::string& frame, const bool replaceable)
+    {
+        // Only a frame that has not started to be written can be replaced,
+        // as the agent would otherwise receive part of it
+        bool replace = replaceable && last_frame_replaceable_ && 
+            last_frame_start_ >= outbox_sent_ && HasPending();
+        size_t kept = replace ? last_frame_start_ : outbox_.size();
+
+        // Leave the queue as it was unless the new frame is accepted
+        if (kept - outbox_sent_ + frame.size() > policy_.max_queued_bytes)
+        {
+            return false;
+        }
+        outbox_.resize(kept);
+
+        if (!HasPending())
+        {
+            time(&last_progress_);
+        }
+        last_frame_start_ = outbox_.size();
+        last_frame_replaceable_ = replaceable;
+        outbox_ += frame;
+        return Flush();
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::SendDatagram(
+        const std::string& message)
+    {
+        out_.assign(SEQUENCE_LEN, '\0');
+        out_ += message;
+        return SendDatagramBuffer(out_);
+    }
+
+    template <typename TFromAgent, typename TToAgent>
+    bool AgentConnection<TFromAgent, TToAgent>::SendDatagramBuffer(
+        std::string& datagram)
+    {
+        uint32_t sequence = htonl(++send_sequence_);
+        datagram.replace(0, SEQUENCE_LEN, 
+            reinterpret_cast<const char*>(&sequence), SEQUENCE_LEN);
+
+        ssize_t sent;
+        do
+        {
+            sent = sendto(sockfd_, datagram.data(), datagram.size(), 
+                          MSG_DONTWAIT | MSG_NOSIGNAL, 
+                          reinterpret_cast<const struct sockaddr*>(&address_), 
+                          sizeof(address_));
+        } while (sent < 0 && errno == EINTR);
+
+        return sent == static_cast<ssize_t>(datagram.size());
+    }
 }
\ No newline at end of file
@@ -22,14 +22,30 @@
 
 #include "Agent.h"
 #include "AgentConnection.h"
+#include "comms/SharedMemoryChannel.h"
 #include "comms/SocketStream.h"
 #include "FromAgent.h"
-#include "utils/Logger.h"
+#include "SendPolicy.h"
+#include "utils/RingBuffer.h"
+#include "utils/SpscQueue.h"
+#include "utils/ThreadSafeLogger.h"
+#include "utils/TripleBuffer.h"
 
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
 #include <iostream>
 #include <netinet/in.h>
+#include <string>
 #include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
@@ -38,15 +54,23 @@ namespace librcsscontroller
 {
     /**
      *  The AgentServer class provides an interface for agent communication over
-     *  TCP. This is useful for designing a simulator controller that sits 
-     *  between agents and rcssserver3d.
+     *  TCP, UDP, AF_UNIX stream sockets or shared memory. Each Init function
+     *  enables one transport, and any combination may be used. This is 
+     *  useful for designing a simulator controller that sits between agents
+     *  and rcssserver3d.
      *
      *  @tparam TFromAgent The class that is expected to be sent by agents to 
      *  the AgentServer. It should inherit from the FromAgent class.
      *  @tparam TToAgent The class that will be sent from the AgentServer to 
      *  agents. It should inherit from the ToAgent class.
+     *  @tparam THistory The number of received updates to keep for each 
+     *  agent, along with their receive times. 0 keeps no history.
+     *
+     *  By default all network I/O happens inside Tick(). After Start(), a
+     *  dedicated thread performs the network I/O instead, and the thread
+     *  using the AgentServer only reads the latest state published by it.
      */
-    template <typename TFromAgent, typename TToAgent>
+    template <typename TFromAgent, typename TToAgent, size_t THistory = 0>
     class AgentServer 
     {
     public:
@@ -55,10 +79,31 @@ namespace librcsscontroller
          */
         typedef AgentConnection<TFromAgent, TToAgent> Client; 
 
+        /**
+         *  An update received from an agent, as kept in its history.
+         */
+        struct TimedUpdate
+        {
+            std::chrono::steady_clock::time_point received; /**< When the update was read from the socket */
+            uint64_t sequence;  /**< The sequence number of the update */
+            TFromAgent update;  /**< The update */
+        };
+
+        /*
+         *  A typedef for the update history kept for each agent.
+         */
+        typedef RingBuffer<TimedUpdate, THistory> UpdateHistory;
+
         /**
          *  Constructor
          */
         AgentServer();
+
+        /**
+         *  Destructor. Stops the I/O thread if it is running.
+         */
+        ~AgentServer();
+
         /**
          *  Initialises the AgentServer.
          *
@@ -69,9 +114,85 @@ namespace librcsscontroller
         bool Init(const int port);
 
         /**
-         *  Ticks the AgentServer. Receives packets from current clients
-         *  and attempts to accept new clients. Also drops inactive or
-         *  disconnected clients.
+         *  Additionally receives agents over UDP. Each datagram from a new
+         *  address is treated as a new agent, and all such agents share one
+         *  socket. See AgentConnection for the datagram format.
+         *
+         *  @param port The port to receive datagrams on.
+         *  @return bool Returns 'true' for success. 'False' for
+         *  failure.
+         */
+        bool InitDatagram(const int port);
+
+        /**
+         *  Listens for agents on an AF_UNIX stream socket. Agents on the same
+         *  machine can connect here instead of over TCP, and are otherwise
+         *  treated the same.
+         *
+         *  @param path The filesystem path to bind the socket to. Any 
+         *  existing file at this path is removed.
+         *  @return bool Returns 'true' for success. 'False' for
+         *  failure.
+         */
+        bool InitUnix(const std::string& path);
+
+        /**
+         *  Creates shared memory channels for agents on the same machine. 
+         *  Each channel is named name.N, for N from 1 to count, and carries 
+         *  one agent at a time. Channels are polled on every tick, so 
+         *  exchanging updates takes no system calls.
+         *
+         *  @param name The name prefix of the channels, e.g. "/findballexp".
+         *  @param count The number of channels to create.
+         *  @return bool Returns 'true' for success. 'False' for
+         *  failure.
+         */
+        bool InitSharedMemory(const std::string& name, const int count);
+
+        /**
+         *  Sets the policy for queueing messages to agents that are not ready
+         *  for them, and for dropping agents that fall too far behind. Only
+         *  applies to stream agents that connect afterwards, and must be 
+         *  called before Start().
+         *
+         *  @param policy The policy to use.
+         */
+        void SetSendPolicy(const SendPolicy& policy);
+
+        /**
+         *  Starts running the AgentServer's network I/O on a dedicated thread.
+         *  Afterwards Tick() no longer touches sockets, Send() and Disconnect()
+         *  are handed to the I/O thread, and the remaining member functions
+         *  must all be called from one thread.
+         *
+         *  @return bool Returns true if the I/O thread was started. False
+         *  otherwise.
+         */
+        bool Start();
+
+        /**
+         *  Sets an eventfd for the I/O thread to signal each time it publishes
+         *  new agents or updates, so the thread calling Tick() can block
+         *  until there is something to pick up.
+         *
+         *  @param fd The eventfd to signal, or -1 for none.
+         */
+        void SetNotifyFd(const int fd);
+
+        /**
+         *  Stops the I/O thread started by Start(), returning all network I/O
+         *  to Tick().
+         */
+        void Stop();
+
+        /**
+         *  Ticks the AgentServer. Waits once (without blocking) for socket
+         *  events, then accepts new clients and receives packets from clients
+         *  with data ready. Also drops inactive or disconnected clients.
+         *
+         *  When the I/O thread is running, this only picks up the latest
+         *  agents and updates it has published. No system calls or locks are
+         *  involved.
          */
         void Tick();
 
@@ -87,7 +208,8 @@ namespace librcsscontroller
          *
          *  @param to_agent The Agent to send to.
          *  @param to_send The TToAgent message to send.         
-         *  @return bool True indicates success. False indicates failure.
+         *  @return bool True indicates success. False indicates failure. When
+         *  the I/O thread is running, true indicates the update was queued.
          */
          bool Send(Agent& to_agent, const TToAgent& to_send);
         
@@ -95,7 +217,8 @@ namespace librcsscontroller
          *  Sends a TToAgent update to all agents.
          *
          *  @param to_send The TToAgent message to send.
-         *  @return bool True indicates success. False indicates failure.
+         *  @return bool True indicates success. False indicates failure. When
+         *  the I/O thread is running, true indicates the update was queued.
          */
          bool Send(const TToAgent& to_send);
 
@@ -108,6 +231,32 @@ namespace librcsscontroller
          */
          bool GetLastUpdate(const Agent& from_agent, TFromAgent* out);
 
+        /**
+         *  Returns a view of the last update received from a specific agent,
+         *  without copying it. The view remains valid until the next call to
+         *  Tick(), Send() or Disconnect().
+         *
+         *  @param from_agent The agent to return the last update from.
+         *  @param sequence[out] If not NULL, is used to store the sequence
+         *  number of the update. Sequence numbers increase each time a new
+         *  update is received from the agent.
+         *  @return const TFromAgent* The last update, or nullptr if no update
+         *  is available.
+         */
+         const TFromAgent* ViewLastUpdate(const Agent& from_agent, 
+            uint64_t* sequence = nullptr) const;
+
+        /**
+         *  Returns a view of the recent updates received from a specific 
+         *  agent, oldest first, including the last update. The view remains
+         *  valid until the next call to Tick(), Send() or Disconnect().
+         *
+         *  @param from_agent The agent to return the history of.
+         *  @return const UpdateHistory* The agent's history, or nullptr if
+         *  the agent has disconnected.
+         */
+         const UpdateHistory* ViewUpdateHistory(const Agent& from_agent) const;
+
         /**
          *  Returns the last update received from all agents.
          *
@@ -120,42 +269,336 @@ namespace librcsscontroller
          *  Disconnects the specified agent from the AgentServer.
          *
          *  @param to_disconnect The agent to disconnect.
-         *  @return bool Returns true if successful. False otherwise.
+         *  @return bool Returns true if successful. False otherwise. When the
+         *  I/O thread is running, true indicates the disconnect was queued.
          */
          bool Disconnect(Agent& to_disconnect);
 
     private:
+        /**
+         *  The maximum number of socket events handled in a single tick.
+         *  Further events are left pending until the next tick.
+         */
+        constexpr static int MAX_EVENTS = 32;
+
+        /**
+         *  The longest time in milliseconds the I/O thread waits for socket
+         *  events before checking for timed out clients.
+         */
+        constexpr static int IO_WAIT_MS = 10;
+
+        /**
+         *  The longest time in milliseconds the I/O thread waits for socket
+         *  events while shared memory channels, which have no events, are in
+         *  use.
+         */
+        constexpr static int SHARED_MEMORY_WAIT_MS = 1;
+
+        /**
+         *  The maximum number of sends and disconnects that can be waiting
+         *  for the I/O thread.
+         */
+        constexpr static size_t MAX_REQUESTS = 64;
+
+        /**
+         *  The epoll tokens for the listening socket and the wake eventfd.
+         *  Client tokens pack the slot generation and index instead, which
+         *  can never reach these values.
+         */
+        constexpr static uint64_t LISTEN_TOKEN = ~0ull;
+        constexpr static uint64_t WAKE_TOKEN = ~0ull - 1;
+        constexpr static uint64_t DATAGRAM_TOKEN = ~0ull - 2;
+        constexpr static uint64_t UNIX_LISTEN_TOKEN = ~0ull - 3;
+
+        /**
+         *  The largest datagram that can be received.
+         */
+        constexpr static size_t MAX_DATAGRAM = 65536;
+
+        /**
+         *  A client and its last update. Slots are reused once their client
+         *  disconnects, and the slot generation is bumped so that Agent
+         *  handles and socket events for the old client no longer match.
+         */
+        struct Slot
+        {
+            Slot()
+                : generation{0}, connected{false}, has_update{false}, 
+                sequence{0}, writing{false}
+            { }
+
+            unsigned int generation;    /**< Bumped each time the slot is freed */
+            bool connected;             /**< Indicates the slot holds a client */
+            Client client;              /**< The connected client */
+            bool has_update;            /**< Indicates an update has been received */
+            TFromAgent update;          /**< The last update received */
+            uint64_t sequence;          /**< Counts the updates received into the slot */
+            UpdateHistory history;      /**< The most recent updates received */
+            bool writing;               /**< Indicates the client is watched for writability */
+        };
+
+        /**
+         *  A shared memory channel and the agent attached to it, if any.
+         */
+        struct Channel
+        {
+            SharedMemoryChannel channel;    /**< The channel */
+            bool active;                    /**< Indicates an agent is using the channel */
+            Agent agent;                    /**< The agent using the channel */
+        };
+
+        /**
+         *  The state of a slot, as published for the thread using the
+         *  AgentServer. Published states are indexed by slot.
+         */
+        struct AgentState
+        {
+            unsigned int generation;    /**< The generation of the slot */
+            bool connected;             /**< Indicates the slot holds a client */
+            bool has_update;            /**< Indicates an update has been received */
+            TFromAgent update;          /**< The last update received */
+            uint64_t sequence;          /**< The sequence number of the update */
+            UpdateHistory history;      /**< The most recent updates received */
+        };
+
+        /**
+         *  A send or disconnect waiting for the I/O thread.
+         */
+        struct Request
+        {
+            enum Type {SEND, BROADCAST, DISCONNECT};
+
+            Type type;          /**< The action to take */
+            Agent agent;        /**< The agent to act on, unless broadcasting */
+            TToAgent message;   /**< The message to send */
+        };
+
+        /**
+         *  Creates the epoll instance and the wake eventfd, unless they 
+         *  already exist.
+         *
+         *  @return bool Returns true if successful. False otherwise.
+         */
+        bool InitEvents();
+
+        /**
+         *  Performs one round of network I/O: accepts new clients, receives
+         *  updates, carries out queued requests and drops timed out clients.
+         *
+         *  @param timeout_ms The longest time to wait for socket events.
+         */
+        void Poll(const int timeout_ms);
+
+        /**
+         *  Runs network I/O until Stop() is called. Executed by the I/O
+         *  thread.
+         */
+        void Run();
+
+        /**
+         *  Carries out the sends and disconnects queued for the I/O thread.
+         */
+        void HandleRequests();
+
+        /**
+         *  Queues a send or disconnect for the I/O thread, and wakes it.
+         *
+         *  @param request The request to queue.
+         *  @return bool Returns true if the request was queued. False if too
+         *  many requests are already waiting.
+         */
+        bool QueueRequest(const Request& request);
+
+        /**
+         *  Publishes the connected agents and their last updates, if they have
+         *  changed since they were last published.
+         */
+        void Publish();
+
+        /**
+         *  Sends a TToAgent update to the client of the specified agent,
+         *  dropping the client if the send fails.
+         *
+         *  @param to_agent The agent to send to.
+         *  @param to_send The TToAgent message to send.
+         *  @return bool True indicates success. False indicates failure.
+         */
+        bool SendToClient(const Agent& to_agent, const TToAgent& to_send);
+
+        /**
+         *  Sends a TToAgent update to all clients. The update is serialised
+         *  and framed once per format in use, and the same frame is written
+         *  to every client using that format.
+         *  Frames a client cannot take yet are queued for it, replacing an 
+         *  unsent older frame if its SendPolicy allows. Eviction is left to
+         *  the SendPolicy: a client is dropped when its queue would exceed 
+         *  max_queued_bytes or it has read nothing for max_stall_sec, and 
+         *  otherwise only when its socket fails.
+         *
+         *  @param to_send The TToAgent message to send.
+         *  @return bool True indicates success. False indicates at least one
+         *  client was dropped.
+         */
+        bool SendToClients(const TToAgent& to_send);
+
         /**
          * Handles new clients connecting.
          * 
+         * @param listenfd The listening socket the client connected to.
          * @return int On success, returns the socket file descriptor of the 
          * connected client. On failure, returns 0.
          */
-        int HandleIncomingClient();     
+        int HandleIncomingClient(const int listenfd);     
+
+        /**
+         *  Adds clients for agents that have attached to a shared memory 
+         *  channel, and receives updates from attached agents.
+         */
+        void PollSharedMemory();
+
+        /**
+         *  Creates a client for a newly accepted socket and registers it for
+         *  socket events.
+         *
+         *  @param cli The socket file descriptor of the accepted client.
+         *  @return bool Returns true if the client was added. False otherwise.
+         */
+        bool AddClient(const int cli);
 
         /**
-         *  Gets the client with the corresponding id.
+         *  Creates a client for an address that has started sending 
+         *  datagrams.
          *
-         *  @param id The clients ID.
-         *  @param out[out] The found client. nullptr if not found.
-         *  @return bool Returns true if a client was found. False otherwise.
+         *  @param address The address of the new client.
+         *  @param out[out] The agent created for the client.
+         *  @return bool Returns true if the client was added. False otherwise.
          */
-        bool GetClient(const int id, Client* out);
+        bool AddDatagramClient(const struct sockaddr_in& address, Agent* out);
 
         /**
-         *  Gets the latest update from the specified client.
+         *  Takes a free slot for a new client.
          *
-         *  @param from The client to receive an update from.
+         *  @return int The index of the slot.
+         */
+        int AllocateSlot();
+
+        /**
+         *  Receives every pending datagram on the UDP socket, handing each to
+         *  the client it came from.
+         */
+        void ReceiveDatagrams();
+
+        /**
+         *  Returns the key identifying an address in peers_.
+         *
+         *  @param address The address.
+         *  @return uint64_t The key.
+         */
+        static uint64_t PeerKey(const struct sockaddr_in& address);
+
+        /**
+         *  Handles the socket events reported for a client, receiving any
+         *  updates that are ready and dropping the client if it has
+         *  disconnected.
+         *
+         *  @param agent The agent the events were reported for.
+         *  @param events The epoll events reported for the client.
+         */
+        void HandleClientEvents(const Agent& agent, const uint32_t events);
+
+        /**
+         *  Watches a stream client for writability while it has queued data,
+         *  and stops once the queue has been written.
+         *
+         *  @param agent The agent of the client.
+         *  @param s The slot of the client.
+         */
+        void WatchWritable(const Agent& agent, Slot& s);
+
+        /**
+         *  Drops clients that have not sent an update within their timeout,
+         *  and clients that have stopped reading.
+         */
+        void DropTimedOutClients();
+
+        /**
+         *  Closes and removes the client of the specified agent, freeing its
+         *  slot for reuse.
+         *
+         *  @param agent The agent to remove.
+         *  @return bool Returns true if a client was removed. False otherwise.
+         */
+        bool RemoveClient(const Agent& agent);
+
+        /**
+         *  Gets the slot of the specified agent.
+         *
+         *  @param agent The agent to look up.
+         *  @return Slot* The agent's slot. nullptr if the agent has
+         *  disconnected or its slot has since been reused.
+         */
+        Slot* FindSlot(const Agent& agent);
+
+        /**
+         *  Packs an agent into an epoll token.
+         *
+         *  @param agent The agent to pack.
+         *  @return uint64_t The token.
+         */
+        static uint64_t ToToken(const Agent& agent);
+
+        /**
+         *  Unpacks an agent from an epoll token.
+         *
+         *  @param token The token to unpack.
+         *  @return Agent The agent.
+         */
+        static Agent FromToken(const uint64_t token);
+
+        /**
+         *  Receives all pending updates from the specified client, keeping
+         *  the newest as its last update and adding all of them to its
+         *  history.
+         *
+         *  @param from The client to receive updates from.
          *  @return bool Returns true if the updates were received successfully.
          *  False otherwise.
          */
-        bool ReceiveClientUpdate(Client& from);
+        bool ReceiveClientUpdate(Slot& from);
+
+        /**
+         *  Stores the updates held in received_ for the specified client.
+         *
+         *  @param from The client the updates were received from.
+         */
+        void StoreUpdates(Slot& from);
 
 
         int sockfd_;                    /**< The socket descriptor for the listening socket */
-        Logger& log_;                   /**< The logging instance in use */
-        std::vector<Client> clients_;   /**< The connected clients */
-        std::unordered_map<int, TFromAgent> received_; /**< Holds received updates */
+        int epollfd_;                   /**< The epoll instance watching all sockets */
+        int wakefd_;                    /**< Wakes the I/O thread when requests are queued */
+        int udpfd_;                     /**< The socket shared by datagram clients */
+        int unixfd_;                    /**< The listening AF_UNIX socket */
+        int notifyfd_;                  /**< Signalled when the I/O thread publishes */
+        SendPolicy policy_;             /**< The policy for new stream clients */
+        ThreadSafeLogger log_;          /**< The logging instance in use */
+        std::vector<Slot> slots_;       /**< The clients and their updates, indexed by agent id */
+        std::vector<int> free_slots_;   /**< Slots available for new clients */
+        bool changed_;                  /**< Indicates clients or updates changed since publishing */
+        std::string broadcast_;         /**< Holds the framed message being broadcast */
+        std::string binary_body_;       /**< Holds the binary message being broadcast */
+        std::string binary_broadcast_;  /**< Holds the framed binary message being broadcast */
+        std::vector<Agent> failed_;     /**< Holds agents that failed a broadcast */
+        std::vector<TFromAgent> received_; /**< Holds updates being received */
+        std::unordered_map<uint64_t, Agent> peers_; /**< The agents of datagram clients, by address */
+        std::vector<char> datagram_;    /**< Holds the datagram being received */
+        std::vector<Channel> channels_; /**< The shared memory channels */
+
+        std::thread io_thread_;         /**< Performs network I/O after Start() */
+        std::atomic<bool> running_;     /**< Indicates the I/O thread is running */
+        TripleBuffer<std::vector<AgentState>> published_; /**< Hands agent state to the reader */
+        const std::vector<AgentState>* view_; /**< The agent state seen by the reader */
+        SpscQueue<Request, MAX_REQUESTS> requests_; /**< Requests waiting for the I/O thread */
 
     };
 }
@@ -20,13 +20,27 @@
 namespace librcsscontroller 
 {
 
-    template <typename TFromAgent, typename TToAgent>
-    AgentServer<TFromAgent, TToAgent>::AgentServer()
-        : sockfd_{0}, log_(Logger::GetInstance())
-    { }
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    AgentServer<TFromAgent, TToAgent, THistory>::AgentServer()
+        : sockfd_{0}, epollfd_{0}, wakefd_{0}, udpfd_{0}, unixfd_{0}, 
+        notifyfd_{-1},
+        changed_{false}, running_{false}
+    { 
+        view_ = &published_.Read();
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    AgentServer<TFromAgent, TToAgent, THistory>::~AgentServer()
+    {
+        Stop();
+        for (auto& c : channels_)
+        {
+            c.channel.Destroy();
+        }
+    }
 
-    template <typename TFromAgent, typename TToAgent>
-    bool AgentServer<TFromAgent, TToAgent>::Init(const int port)
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::Init(const int port)
     {
         struct sockaddr_in serv_addr;
 
@@ -66,205 +80,957 @@ namespace librcsscontroller
             return false;
         }
 
+        if (fcntl(sockfd_, F_SETFL, fcntl(sockfd_, F_GETFL) | O_NONBLOCK) < 0)
+        {
+            log_(LogLevel::ERROR) << "Error making server socket non-blocking!\n";
+            return false;
+        }
+
         listen(sockfd_, 22);
+
+        if (!InitEvents())
+        {
+            return false;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = LISTEN_TOKEN;
+        if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, sockfd_, &ev) < 0)
+        {
+            log_(LogLevel::ERROR) << "Error watching server socket!\n";
+            return false;
+        }
         return true;
     }
 
-    template <typename TFromAgent, typename TToAgent>
-    void AgentServer<TFromAgent, TToAgent>::Tick()
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::InitDatagram(const int port)
     {
-        int cli = HandleIncomingClient();
-        if (cli > 0)
-        {        
-            SocketStream ss;
-            ss.Init(cli);
+        struct sockaddr_in serv_addr;
 
-            EndpointConnection ec;
-            if (!ec.Init(ss))
-            {
-                log_(LogLevel::ERROR) << "Error accepting client " << cli << "!\n";
-            }
+        udpfd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (udpfd_ < 0)
+        { 
+            log_(LogLevel::ERROR) << "Error opening datagram socket!\n";
+            return false;
+        }
+
+        bzero((char *) &serv_addr, sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = INADDR_ANY;
+        serv_addr.sin_port = htons(port);
+
+        if (bind(udpfd_, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) 
+        {
+            log_(LogLevel::ERROR) << "Error binding datagram socket!\n";
+            return false;
+        }
+
+        if (!InitEvents())
+        {
+            return false;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = DATAGRAM_TOKEN;
+        if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, udpfd_, &ev) < 0)
+        {
+            log_(LogLevel::ERROR) << "Error watching datagram socket!\n";
+            return false;
+        }
+        datagram_.resize(MAX_DATAGRAM);
+        return true;
+    }
 
-            AgentConnection<TFromAgent, TToAgent> ac;
-            if (!ac.Init(ec))
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::InitUnix(const std::string& path)
+    {
+        struct sockaddr_un serv_addr;
+        if (path.size() >= sizeof(serv_addr.sun_path))
+        {
+            log_(LogLevel::ERROR) << "Unix socket path too long!\n";
+            return false;
+        }
+
+        unixfd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (unixfd_ < 0)
+        { 
+            log_(LogLevel::ERROR) << "Error opening unix socket!\n";
+            return false;
+        }
+
+        bzero((char *) &serv_addr, sizeof(serv_addr));
+        serv_addr.sun_family = AF_UNIX;
+        path.copy(serv_addr.sun_path, path.size());
+
+        unlink(path.c_str());
+        if (bind(unixfd_, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) 
+        {
+            log_(LogLevel::ERROR) << "Error binding unix socket!\n";
+            return false;
+        }
+
+        listen(unixfd_, 22);
+
+        if (!InitEvents())
+        {
+            return false;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = UNIX_LISTEN_TOKEN;
+        if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, unixfd_, &ev) < 0)
+        {
+            log_(LogLevel::ERROR) << "Error watching unix socket!\n";
+            return false;
+        }
+        return true;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::InitSharedMemory(
+        const std::string& name, const int count)
+    {
+        for (int i = 1; i <= count; ++i)
+        {
+            Channel c;
+            c.active = false;
+            if (!c.channel.Create(name + "." + std::to_string(i)))
             {
-                log_(LogLevel::ERROR) << "Error accepting client " << cli << "!\n";
+                log_(LogLevel::ERROR) << "Error creating shared memory channel "
+                    << name << "." << i << "!\n";
+                return false;
             }
+            channels_.push_back(c);
+        }
+        return InitEvents();
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::InitEvents()
+    {
+        if (epollfd_ > 0)
+        {
+            return true;
+        }
+
+        epollfd_ = epoll_create1(0);
+        if (epollfd_ < 0)
+        {
+            log_(LogLevel::ERROR) << "Error creating epoll instance!\n";
+            return false;
+        }
+
+        struct epoll_event ev;
+        wakefd_ = eventfd(0, EFD_NONBLOCK);
+        ev.events = EPOLLIN;
+        ev.data.u64 = WAKE_TOKEN;
+        if (wakefd_ < 0 || epoll_ctl(epollfd_, EPOLL_CTL_ADD, wakefd_, &ev) < 0)
+        {
+            log_(LogLevel::ERROR) << "Error creating wake event!\n";
+            return false;
+        }
+        return true;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::SetSendPolicy(
+        const SendPolicy& policy)
+    {
+        policy_ = policy;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::Start()
+    {
+        if (running_ || epollfd_ <= 0)
+        {
+            return false;
+        }
+        running_ = true;
+        io_thread_ = std::thread(&AgentServer::Run, this);
+        return true;
+    }
 
-            log_(LogLevel::INFO) << "Accepted client: " << cli << "\n";
-            clients_.push_back(ac);
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::SetNotifyFd(const int fd)
+    {
+        notifyfd_ = fd;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::Stop()
+    {
+        if (!running_)
+        {
+            return;
         }
+        running_ = false;
+        io_thread_.join();
 
-        for (auto itr = clients_.begin(); itr != clients_.end(); )
+        // Carry out anything queued just before stopping
+        HandleRequests();
+        Publish();
+        view_ = &published_.Read();
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::Tick()
+    {
+        if (!running_)
         {
-            if (!ReceiveClientUpdate(*itr))
+            Poll(0);
+        }
+        view_ = &published_.Read();
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::Poll(const int timeout_ms)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int num_events = epoll_wait(epollfd_, events, MAX_EVENTS, timeout_ms);
+
+        for (int i = 0; i < num_events; ++i)
+        {
+            if (events[i].data.u64 == LISTEN_TOKEN || 
+                events[i].data.u64 == UNIX_LISTEN_TOKEN)
             {
-                itr = clients_.erase(itr);
+                int listenfd = events[i].data.u64 == LISTEN_TOKEN ? sockfd_ 
+                                                                  : unixfd_;
+                int cli;
+                while ((cli = HandleIncomingClient(listenfd)) > 0)
+                {
+                    AddClient(cli);
+                }
+            }
+            else if (events[i].data.u64 == WAKE_TOKEN)
+            {
+                uint64_t count;
+                read(wakefd_, &count, sizeof(count));
+            }
+            else if (events[i].data.u64 == DATAGRAM_TOKEN)
+            {
+                ReceiveDatagrams();
             }
             else
             {
-                ++itr;
+                HandleClientEvents(FromToken(events[i].data.u64), 
+                    events[i].events);
             }
         }
+
+        PollSharedMemory();
+        HandleRequests();
+        DropTimedOutClients();
+        Publish();
     }
 
-    template <typename TFromAgent, typename TToAgent>
-    std::vector<Agent> AgentServer<TFromAgent, TToAgent>::GetAgents() const
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::Run()
+    {
+        int wait_ms = channels_.empty() ? IO_WAIT_MS : SHARED_MEMORY_WAIT_MS;
+        while (running_)
+        {
+            Poll(wait_ms);
+        }
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    std::vector<Agent> AgentServer<TFromAgent, TToAgent, THistory>::GetAgents() const
     {
         std::vector<Agent> agents;
 
-        for (const auto& c : clients_)
+        for (size_t i = 0; i < view_->size(); ++i)
         {
-            agents.push_back(Agent{c.GetId()});
+            const auto& a = (*view_)[i];
+            if (a.connected)
+            {
+                agents.push_back(Agent{static_cast<int>(i), a.generation});
+            }
         }
         return agents;
     }
 
-    template <typename TFromAgent, typename TToAgent>
-    bool AgentServer<TFromAgent, TToAgent>::Send(Agent& to_agent, const TToAgent& to_send)
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::Send(Agent& to_agent, const TToAgent& to_send)
     {
-        Client c;
-        if (!GetClient(to_agent.id, &c))
+        if (running_)
         {
-            return false;
+            return QueueRequest(Request{Request::SEND, to_agent, to_send});
+        }
+
+        bool result = SendToClient(to_agent, to_send);
+        Publish();
+        view_ = &published_.Read();
+        return result;
+    }
+        
+    template <typename TFromAgent, typename TToAgent, size_t THistory>        
+    bool AgentServer<TFromAgent, TToAgent, THistory>::Send(const TToAgent& to_send)
+    {
+        if (running_)
+        {
+            return QueueRequest(Request{Request::BROADCAST, Agent(), to_send});
         }
-        if (!c.Send(to_send))
+
+        bool result = SendToClients(to_send);
+        Publish();
+        view_ = &published_.Read();
+        return result;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::GetLastUpdate(const Agent& from_agent, TFromAgent* out)
+    {
+        const TFromAgent* update = ViewLastUpdate(from_agent);
+        if (update == nullptr)
         {
-            Disconnect(to_agent);
             return false;
         }
+        *out = *update;
         return true;
     }
-        
-    template <typename TFromAgent, typename TToAgent>        
-    bool AgentServer<TFromAgent, TToAgent>::Send(const TToAgent& to_send)
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    const TFromAgent* AgentServer<TFromAgent, TToAgent, THistory>::ViewLastUpdate(
+        const Agent& from_agent, uint64_t* sequence) const
+    {
+        if (from_agent.id < 0 || 
+            static_cast<size_t>(from_agent.id) >= view_->size())
+        {
+            return nullptr;
+        }
+
+        const auto& a = (*view_)[from_agent.id];
+        if (!a.connected || a.generation != from_agent.generation || 
+            !a.has_update)
+        {
+            return nullptr;
+        }
+        if (sequence)
+        {
+            *sequence = a.sequence;
+        }
+        return &a.update;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    const typename AgentServer<TFromAgent, TToAgent, THistory>::UpdateHistory* 
+        AgentServer<TFromAgent, TToAgent, THistory>::ViewUpdateHistory(
+        const Agent& from_agent) const
     {
-        bool result = true;
-        for (auto& a : GetAgents())
+        if (from_agent.id < 0 || 
+            static_cast<size_t>(from_agent.id) >= view_->size())
+        {
+            return nullptr;
+        }
+
+        const auto& a = (*view_)[from_agent.id];
+        if (!a.connected || a.generation != from_agent.generation)
         {
-            if (!Send(a, to_send))
+            return nullptr;
+        }
+        return &a.history;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    std::vector<TFromAgent> AgentServer<TFromAgent, TToAgent, THistory>::GetLastUpdates()
+    {
+        std::vector<TFromAgent> to_return;
+        for (const auto& a : *view_)
+        {
+            if (a.connected && a.has_update)
             {
-                result = false;
+                to_return.push_back(a.update);
             }
         }
+        return to_return;
+    }
+
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::Disconnect(Agent& to_disconnect)
+    {
+        if (running_)
+        {
+            return QueueRequest(Request{Request::DISCONNECT, to_disconnect, 
+                TToAgent()});
+        }
+
+        bool result = RemoveClient(to_disconnect);
+        Publish();
+        view_ = &published_.Read();
         return result;
     }
 
-    template <typename TFromAgent, typename TToAgent>
-    bool AgentServer<TFromAgent, TToAgent>::GetLastUpdate(const Agent& from_agent, TFromAgent* out)
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::HandleRequests()
+    {
+        Request r;
+        while (requests_.Pop(&r))
+        {
+            switch (r.type)
+            {
+                case Request::SEND:
+                    SendToClient(r.agent, r.message);
+                    break;
+                case Request::BROADCAST:
+                    SendToClients(r.message);
+                    break;
+                case Request::DISCONNECT:
+                    RemoveClient(r.agent);
+                    break;
+            }
+        }
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::QueueRequest(const Request& request)
     {
-        if (received_.find(from_agent.id) == received_.end())
+        if (!requests_.Push(request))
         {
             return false;
         }
-        *out = received_[from_agent.id];
+        uint64_t one = 1;
+        write(wakefd_, &one, sizeof(one));
         return true;
     }
 
-    template <typename TFromAgent, typename TToAgent>
-    std::vector<TFromAgent> AgentServer<TFromAgent, TToAgent>::GetLastUpdates()
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::Publish()
     {
-        std::vector<TFromAgent> to_return;
-        for (auto& a : GetAgents())
+        if (!changed_)
+        {
+            return;
+        }
+
+        // Resizing keeps previously published updates, so their storage is
+        // reused instead of reallocated
+        auto& states = published_.GetWriteBuffer();
+        states.resize(slots_.size());
+        for (size_t i = 0; i < slots_.size(); ++i)
         {
-            TFromAgent update;
-            if (GetLastUpdate(a, &update))
+            const Slot& s = slots_[i];
+
+            // The buffer may hold the history of a previous client
+            if (states[i].generation != s.generation)
+            {
+                states[i].history.Clear();
+            }
+
+            // Only copy history the buffer does not already hold
+            size_t held = states[i].history.Size();
+            uint64_t newest = held > 0 ? states[i].history[held-1].sequence : 0;
+            for (size_t j = 0; j < s.history.Size(); ++j)
+            {
+                if (s.history[j].sequence > newest)
+                {
+                    states[i].history.Push() = s.history[j];
+                }
+            }
+
+            states[i].generation = s.generation;
+            states[i].connected = s.connected;
+            states[i].has_update = s.connected && s.has_update;
+
+            // Sequence numbers are never reused within a slot, so a matching
+            // sequence means the buffer already holds this update
+            if (states[i].has_update && states[i].sequence != s.sequence)
             {
-                to_return.push_back(update);
+                states[i].update = s.update;
+                states[i].sequence = s.sequence;
             }
         }
-        return to_return;
-    }
+        published_.Publish();
+        changed_ = false;
 
+        if (running_ && notifyfd_ >= 0)
+        {
+            uint64_t one = 1;
+            write(notifyfd_, &one, sizeof(one));
+        }
+    }
 
-    template <typename TFromAgent, typename TToAgent>
-    bool AgentServer<TFromAgent, TToAgent>::Disconnect(Agent& to_disconnect)
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::SendToClient(const Agent& to_agent, 
+        const TToAgent& to_send)
     {
-        Client c;
-        if (!GetClient(to_disconnect.id, &c))
+        Slot* s = FindSlot(to_agent);
+        if (s == nullptr)
         {
             return false;
         }
-        if (!c.Close())
+        if (!s->client.Send(to_send))
         {
+            log_(LogLevel::WARNING) << "Error sending to client " 
+                << s->client.GetId() << ". Dropping client.\n";
+            RemoveClient(to_agent);
             return false;
         }
-        clients_.erase(std::find_if(clients_.begin(), clients_.end(),
-            [c](const Client& a){ return a.GetId() == c.GetId(); }));
-        return true;        
+        WatchWritable(to_agent, *s);
+        return true;
     }
 
-    template <typename TFromAgent, typename TToAgent>
-    int AgentServer<TFromAgent, TToAgent>::HandleIncomingClient()
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::SendToClients(const TToAgent& to_send)
     {
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(sockfd_, &rfds);
+        // Each format is encoded at most once, and only if a client uses it
+        bool text_encoded = false;
+        bool binary_encoded = false;
 
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 1;
-        if (!select(sockfd_+1, &rfds, NULL, NULL, &timeout))
+        failed_.clear();
+        for (size_t i = 0; i < slots_.size(); ++i)
         {
-            return 0;
+            Slot& s = slots_[i];
+            if (!s.connected)
+            {
+                continue;
+            }
+
+            bool sent;
+            if (s.client.IsBinary())
+            {
+                if (!binary_encoded)
+                {
+                    binary_encoded = true;
+                    binary_body_.clear();
+                    to_send.ToBinary(&binary_body_);
+                    FrameBuffer::Encode(binary_body_, &binary_broadcast_);
+                }
+                sent = s.client.SendFrame(binary_broadcast_);
+            }
+            else
+            {
+                if (!text_encoded)
+                {
+                    text_encoded = true;
+                    FrameBuffer::Encode(to_send.ToMessage(), &broadcast_);
+                }
+                sent = s.client.SendFrame(broadcast_);
+            }
+
+            Agent agent{static_cast<int>(i), s.generation};
+            if (!sent)
+            {
+                failed_.push_back(agent);
+            }
+            else
+            {
+                WatchWritable(agent, s);
+            }
+        }
+
+        for (const auto& a : failed_)
+        {
+            log_(LogLevel::WARNING) << "Error sending to client " 
+                << slots_[a.id].client.GetId() << ". Dropping client.\n";
+            RemoveClient(a);
         }
+        return failed_.empty();
+    }
 
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    int AgentServer<TFromAgent, TToAgent, THistory>::HandleIncomingClient(
+        const int listenfd)
+    {
         socklen_t clilen;
-        struct sockaddr_in serv_addr, cli_addr;
+        struct sockaddr_storage cli_addr;
 
         clilen = sizeof(cli_addr);
-        int newsockfd = accept(sockfd_, 
+        int newsockfd = accept(listenfd, 
             (struct sockaddr *) &cli_addr, 
             &clilen);
-     
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 1;
-        if (setsockopt (newsockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout,
-                         sizeof(timeout)) < 0)
+        if (newsockfd < 0)
         {
-            log_(LogLevel::ERROR) << "client setsockopt failed!\n";
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                log_(LogLevel::ERROR) << "Error accepting client!\n";
+            }
             return 0;
         }
-     
+
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 1;
         if (setsockopt (newsockfd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,
                     sizeof(timeout)) < 0)
         {
             log_(LogLevel::ERROR) << "client setsockopt failed!\n";
+            close(newsockfd);
             return 0;
         }
+        return newsockfd;      
+    }
 
-        if (newsockfd < 0) 
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::PollSharedMemory()
+    {
+        for (size_t i = 0; i < channels_.size(); ++i)
         {
-            log_(LogLevel::ERROR) << "Error accepting client!\n";
-            return 0;
+            Channel& c = channels_[i];
+            if (!c.active)
+            {
+                if (!c.channel.IsAttached())
+                {
+                    continue;
+                }
+
+                AgentConnection<TFromAgent, TToAgent> ac;
+                ac.InitSharedMemory(c.channel, i);
+
+                int index = AllocateSlot();
+                Slot& s = slots_[index];
+                s.connected = true;
+                s.client = ac;
+                s.has_update = false;
+                c.agent = Agent{index, s.generation};
+                c.active = true;
+                changed_ = true;
+                log_(LogLevel::INFO) << "Accepted shared memory client: " 
+                    << i + 1 << "\n";
+            }
+
+            Slot* s = FindSlot(c.agent);
+            if (s && !ReceiveClientUpdate(*s))
+            {
+                log_(LogLevel::INFO) << "Shared memory client " << i + 1 
+                    << " disconnected.\n";
+                RemoveClient(c.agent);
+            }
         }
-        return newsockfd;      
     }
 
-    template <typename TFromAgent, typename TToAgent>
-    bool AgentServer<TFromAgent, TToAgent>::GetClient(const int id, Client* out)
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::AddClient(const int cli)
     {
-        auto itr = std::find_if(clients_.begin(), clients_.end(), 
-            [id](const Client& c){return c.GetId() == id;});
+        SocketStream ss;
+        ss.Init(cli);
 
-        if (itr == clients_.end())
+        EndpointConnection ec;
+        bool connected;
         {
+            // EndpointConnection logs through Logger directly
+            auto lock = ThreadSafeLogger::Lock();
+            connected = ec.Init(ss);
+        }
+        if (!connected)
+        {
+            log_(LogLevel::ERROR) << "Error accepting client " << cli << "!\n";
+        }
+
+        AgentConnection<TFromAgent, TToAgent> ac;
+        if (!ac.Init(ec))
+        {
+            log_(LogLevel::ERROR) << "Error accepting client " << cli << "!\n";
+        }
+        ac.SetSendPolicy(policy_);
+
+        int index = AllocateSlot();
+        Agent agent{index, slots_[index].generation};
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = ToToken(agent);
+        if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, cli, &ev) < 0)
+        {
+            log_(LogLevel::ERROR) << "Error watching client " << cli << "!\n";
+            close(cli);
+            free_slots_.push_back(index);
             return false;
         }
-        *out = *itr;        
+
+        log_(LogLevel::INFO) << "Accepted client: " << cli << "\n";
+        Slot& s = slots_[index];
+        s.connected = true;
+        s.client = ac;
+        s.has_update = false;
+        changed_ = true;
         return true;
-    }    
+    }
 
-    template <typename TFromAgent, typename TToAgent>
-    bool AgentServer<TFromAgent, TToAgent>::ReceiveClientUpdate(Client& from)
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::AddDatagramClient(
+        const struct sockaddr_in& address, Agent* out)
     {
-        TFromAgent update;
-        if (!from.Receive(&update))
+        AgentConnection<TFromAgent, TToAgent> ac;
+        if (!ac.InitDatagram(udpfd_, address))
         {
             return false;
         }
-        received_[from.GetId()] = update;
+
+        int index = AllocateSlot();
+        Slot& s = slots_[index];
+        s.connected = true;
+        s.client = ac;
+        s.has_update = false;
+        *out = Agent{index, s.generation};
+        peers_[PeerKey(address)] = *out;
+        changed_ = true;
+
+        char host[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        log_(LogLevel::INFO) << "Accepted datagram client: " 
+            << host << ":" << ntohs(address.sin_port) << "\n";
         return true;
     }
 
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    int AgentServer<TFromAgent, TToAgent, THistory>::AllocateSlot()
+    {
+        // Reuse a freed slot if possible, so agent ids stay small
+        if (!free_slots_.empty())
+        {
+            int index = free_slots_.back();
+            free_slots_.pop_back();
+            return index;
+        }
+        slots_.push_back(Slot());
+        return static_cast<int>(slots_.size()) - 1;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::ReceiveDatagrams()
+    {
+        struct sockaddr_in address;
+        socklen_t address_len;
+        ssize_t size;
+
+        while (true)
+        {
+            address_len = sizeof(address);
+            size = recvfrom(udpfd_, datagram_.data(), datagram_.size(), 0, 
+                            (struct sockaddr *) &address, &address_len);
+            if (size < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+
+            Agent agent;
+            auto itr = peers_.find(PeerKey(address));
+            if (itr != peers_.end())
+            {
+                agent = itr->second;
+            }
+            else if (!AddDatagramClient(address, &agent))
+            {
+                continue;
+            }
+
+            Slot* s = FindSlot(agent);
+            received_.clear();
+            if (!s->client.ReceiveDatagram(datagram_.data(), size, &received_))
+            {
+                char host[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+                log_(LogLevel::WARNING) << "Malformed datagram from " 
+                    << host << ":" 
+                    << ntohs(address.sin_port) << ". Dropping client.\n";
+                RemoveClient(agent);
+                continue;
+            }
+            StoreUpdates(*s);
+        }
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    uint64_t AgentServer<TFromAgent, TToAgent, THistory>::PeerKey(
+        const struct sockaddr_in& address)
+    {
+        return (static_cast<uint64_t>(address.sin_addr.s_addr) << 16) | 
+            address.sin_port;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::HandleClientEvents(
+        const Agent& agent, const uint32_t events)
+    {
+        // Events for a client removed earlier in this tick no longer match
+        // its slot, even if the slot has already been reused
+        Slot* s = FindSlot(agent);
+        if (s == nullptr)
+        {
+            return;
+        }
+
+        // Data sent just before a hangup is still received before dropping
+        bool connected = !(events & (EPOLLHUP | EPOLLERR));
+        if (events & (EPOLLIN | EPOLLRDHUP))
+        {
+            connected = ReceiveClientUpdate(*s) && connected;
+        }
+        if (connected && (events & EPOLLOUT))
+        {
+            connected = s->client.Flush();
+            WatchWritable(agent, *s);
+        }
+
+        if (!connected)
+        {
+            log_(LogLevel::INFO) << "Client " << s->client.GetId() 
+                << " disconnected.\n";
+            RemoveClient(agent);
+        }
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::WatchWritable(
+        const Agent& agent, Slot& s)
+    {
+        bool pending = s.client.HasPending();
+        if (pending == s.writing)
+        {
+            return;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP 
+            | (pending ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        ev.data.u64 = ToToken(agent);
+        if (epoll_ctl(epollfd_, EPOLL_CTL_MOD, s.client.GetId(), &ev) == 0)
+        {
+            s.writing = pending;
+        }
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::DropTimedOutClients()
+    {
+        time_t now;
+        time(&now);
+
+        // Slots never move, so clients can be removed while iterating
+        for (size_t i = 0; i < slots_.size(); ++i)
+        {
+            Slot& s = slots_[i];
+            if (!s.connected)
+            {
+                continue;
+            }
+
+            if (s.client.IsTimedOut(now))
+            {
+                log_(LogLevel::WARNING) << "Client " << s.client.GetId() 
+                    << " timed out!\n";
+                RemoveClient(Agent{static_cast<int>(i), s.generation});
+            }
+            else if (s.client.IsStalled(now))
+            {
+                log_(LogLevel::WARNING) << "Client " << s.client.GetId() 
+                    << " stopped reading. Dropping client.\n";
+                RemoveClient(Agent{static_cast<int>(i), s.generation});
+            }
+        }
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::RemoveClient(const Agent& agent)
+    {
+        Slot* s = FindSlot(agent);
+        if (s == nullptr)
+        {
+            return false;
+        }
+
+        switch (s->client.GetTransport())
+        {
+            case Client::DATAGRAM:
+                peers_.erase(PeerKey(s->client.GetAddress()));
+                break;
+            case Client::SHARED_MEMORY:
+                // Lets another agent claim the channel
+                channels_[s->client.GetId()].active = false;
+                channels_[s->client.GetId()].channel.Release();
+                break;
+            default:
+                epoll_ctl(epollfd_, EPOLL_CTL_DEL, s->client.GetId(), NULL);
+                break;
+        }
+        bool closed = s->client.Close();
+
+        // A client that reuses this slot must not inherit the old update
+        s->connected = false;
+        s->writing = false;
+        ++s->generation;
+        s->client = Client();
+        s->has_update = false;
+        s->update = TFromAgent();
+        s->history.Clear();
+        free_slots_.push_back(agent.id);
+        changed_ = true;
+        return closed;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    typename AgentServer<TFromAgent, TToAgent, THistory>::Slot* 
+        AgentServer<TFromAgent, TToAgent, THistory>::FindSlot(const Agent& agent)
+    {
+        if (agent.id < 0 || static_cast<size_t>(agent.id) >= slots_.size())
+        {
+            return nullptr;
+        }
+
+        Slot& s = slots_[agent.id];
+        if (!s.connected || s.generation != agent.generation)
+        {
+            return nullptr;
+        }
+        return &s;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    uint64_t AgentServer<TFromAgent, TToAgent, THistory>::ToToken(const Agent& agent)
+    {
+        return (static_cast<uint64_t>(agent.generation) << 32) | 
+            static_cast<uint32_t>(agent.id);
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    Agent AgentServer<TFromAgent, TToAgent, THistory>::FromToken(const uint64_t token)
+    {
+        return Agent{static_cast<int>(token & 0xffffffff), 
+            static_cast<unsigned int>(token >> 32)};
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    bool AgentServer<TFromAgent, TToAgent, THistory>::ReceiveClientUpdate(Slot& from)
+    {
+        received_.clear();
+        bool ok = from.client.Receive(&received_);
+        StoreUpdates(from);
+        return ok;
+    }
+
+    template <typename TFromAgent, typename TToAgent, size_t THistory>
+    void AgentServer<TFromAgent, TToAgent, THistory>::StoreUpdates(Slot& from)
+    {
+        if (received_.empty())
+        {
+            return;
+        }
+
+        // Every update read is sequenced and kept in the history, but only
+        // the newest becomes the last update
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& u : received_)
+        {
+            ++from.sequence;
+            if (THistory > 0)
+            {
+                TimedUpdate& t = from.history.Push();
+                t.received = now;
+                t.sequence = from.sequence;
+                t.update = u;
+            }
+        }
+        from.update = received_.back();
+        from.has_update = true;
+        changed_ = true;
+    }
+
 }
\ No newline at end of file
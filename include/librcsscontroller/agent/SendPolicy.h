@@ -0,0 +1,46 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+ 
+#ifndef LIBRCSSCONTROLLER_SENDPOLICY_H_
+#define LIBRCSSCONTROLLER_SENDPOLICY_H_
+
+#include <cstddef>
+
+namespace librcsscontroller
+{
+    /**
+     *  The SendPolicy struct decides how messages are queued for an agent
+     *  that cannot keep up, and when such an agent is dropped.
+     */
+    struct SendPolicy
+    {
+    public:
+        SendPolicy()
+            : max_queued_bytes{1 << 16}, replace_unsent{true}, 
+            max_stall_sec{2.0}
+        { }
+
+        size_t max_queued_bytes;    /**< Agents with more unsent data are dropped */
+        bool replace_unsent;        /**< A new message replaces an unsent older one */
+        double max_stall_sec;       /**< Agents that read nothing for this long are dropped */
+    };
+
+}
+
+#endif // LIBRCSSCONTROLLER_SENDPOLICY_H_
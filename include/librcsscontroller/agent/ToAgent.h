@@ -22,6 +22,9 @@
 
 #include "comms/MessageParser.h"
 
+#include <cstddef>
+#include <string>
+
 namespace librcsscontroller 
 {
     /**
@@ -51,6 +54,35 @@ namespace librcsscontroller
          *  false otherwise.
          */
         virtual bool FromMessage(const std::string& received) = 0;
+
+        /**
+         *  Converts the inherited type to its fixed-layout, little-endian 
+         *  binary representation, used instead of ToMessage() once an agent
+         *  has negotiated the binary format. Types without a binary 
+         *  representation keep this default, which always fails.
+         *
+         *  @param out[out] The string to write the binary representation to.
+         *  @return bool True if the binary representation was written, false
+         *  otherwise.
+         */
+        virtual bool ToBinary(std::string*) const
+        {
+            return false;
+        }
+
+        /**
+         *  Populates the inherited type using its binary representation. The
+         *  reverse of the ToBinary() function.
+         *
+         *  @param data The received binary representation.
+         *  @param size The size of the received binary representation.
+         *  @return bool True if the struct was successfully populated,
+         *  false otherwise.
+         */
+        virtual bool FromBinary(const char*, size_t)
+        {
+            return false;
+        }
     };
 
 }
@@ -0,0 +1,212 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_FRAMEBUFFER_H_
+#define LIBRCSSCONTROLLER_FRAMEBUFFER_H_
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+namespace librcsscontroller
+{
+    /**
+     *  The FrameBuffer class reassembles length-prefixed messages (the framing
+     *  used by EndpointConnection) from a socket without blocking.
+     *
+     *  Each frame is a 4-byte network order length followed by the message.
+     *  Bytes are accumulated across calls, so headers and bodies that arrive
+     *  split across several reads are held until the frame is complete.
+     */
+    class FrameBuffer
+    {
+    public:
+        /**
+         *  The size in bytes of a frame header.
+         */
+        constexpr static size_t HEADER_LEN = 4;
+
+        /**
+         *  Constructor
+         */
+        FrameBuffer()
+            : read_pos_{0}, malformed_{false}
+        { }
+
+        /**
+         *  Reads all data currently available on a socket, then extracts every
+         *  complete frame. Never blocks.
+         *
+         *  @param socketfd The socket file descriptor to read from.
+         *  @param out[out] Complete frames are appended to this vector. Zero,
+         *  one or many frames may be appended.
+         *  @return bool True if the connection is still open. False if the
+         *  peer closed the connection, a socket error occurred, a malformed
+         *  frame was received or more than MAX_BUFFER_LEN bytes were pending.
+         *  Frames completed before the failure are still appended to out.
+         */
+        bool Receive(const int socketfd, std::vector<std::string>* out)
+        {
+            bool open = Fill(socketfd);
+
+            std::string frame;
+            while (Next(&frame))
+            {
+                out->push_back(std::move(frame));
+            }
+            Compact();
+
+            return open && !malformed_;
+        }
+
+        /**
+         *  Frames a message for sending, by prefixing it with its length.
+         *
+         *  @param message The message to frame.
+         *  @param out[out] The string to write the framed message to.
+         */
+        static void Encode(const std::string& message, std::string* out)
+        {
+            uint32_t nlen = htonl(message.size());
+            out->assign(reinterpret_cast<const char*>(&nlen), HEADER_LEN);
+            out->append(message);
+        }
+
+        /**
+         *  Discards any partially received data.
+         */
+        void Clear()
+        {
+            buffer_.clear();
+            read_pos_ = 0;
+            malformed_ = false;
+        }
+
+    private:
+        /**
+         *  The number of bytes requested from the socket per read.
+         */
+        constexpr static size_t READ_CHUNK = 4096;
+
+        /**
+         *  The largest frame accepted. Larger lengths indicate a corrupted
+         *  stream.
+         */
+        constexpr static uint32_t MAX_FRAME_LEN = 1 << 24;
+
+        /**
+         *  The most bytes held at once. A peer that sends more than this
+         *  without it being extracted is flooding the connection.
+         */
+        constexpr static size_t MAX_BUFFER_LEN = MAX_FRAME_LEN + HEADER_LEN;
+
+        /**
+         *  Reads from the socket until no more data is available, or the
+         *  buffer is full.
+         *
+         *  @param socketfd The socket file descriptor to read from.
+         *  @return bool True if the connection is still open. False otherwise,
+         *  including when the buffer overflows.
+         */
+        bool Fill(const int socketfd)
+        {
+            while (true)
+            {
+                size_t old_size = buffer_.size();
+                if (old_size >= MAX_BUFFER_LEN)
+                {
+                    malformed_ = true;
+                    return false;
+                }
+                buffer_.resize(old_size + READ_CHUNK);
+                ssize_t n = recv(socketfd, &buffer_[old_size], READ_CHUNK,
+                                 MSG_DONTWAIT);
+                buffer_.resize(old_size + (n > 0 ? n : 0));
+
+                if (n > 0)
+                {
+                    continue;
+                }
+                if (n == 0)
+                {
+                    return false;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+
+        /**
+         *  Extracts the next complete frame from the buffer.
+         *
+         *  @param out[out] The string to write the frame to.
+         *  @return bool True if a frame was extracted. False if no complete
+         *  frame is buffered.
+         */
+        bool Next(std::string* out)
+        {
+            size_t available = buffer_.size() - read_pos_;
+            if (malformed_ || available < HEADER_LEN)
+            {
+                return false;
+            }
+
+            uint32_t nlen;
+            memcpy(&nlen, &buffer_[read_pos_], HEADER_LEN);
+            uint32_t len = ntohl(nlen);
+            if (len > MAX_FRAME_LEN)
+            {
+                malformed_ = true;
+                return false;
+            }
+            if (available < HEADER_LEN + len)
+            {
+                return false;
+            }
+
+            out->assign(buffer_, read_pos_ + HEADER_LEN, len);
+            read_pos_ += HEADER_LEN + len;
+            return true;
+        }
+
+        /**
+         *  Removes extracted frames from the front of the buffer, keeping any
+         *  partially received frame.
+         */
+        void Compact()
+        {
+            buffer_.erase(0, read_pos_);
+            read_pos_ = 0;
+        }
+
+        std::string buffer_;    /**< Bytes received but not yet extracted */
+        size_t read_pos_;       /**< The start of the next unextracted frame */
+        bool malformed_;        /**< Indicates a corrupted frame header or an overflow */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_FRAMEBUFFER_H_
@@ -0,0 +1,44 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_LITTLEENDIAN_H_
+#define LIBRCSSCONTROLLER_LITTLEENDIAN_H_
+
+#include <cstdint>
+#include <cstring>
+
+namespace librcsscontroller
+{
+    /**
+     *  Converts a value between host byte order and little-endian byte 
+     *  order. The conversion is its own inverse, and does nothing on 
+     *  little-endian hosts.
+     *
+     *  @tparam T The type of value to convert. Must be an integer or 
+     *  floating point type of 1, 2, 4 or 8 bytes.
+     *  @param value The value to convert.
+     *  @return T The converted value.
+     */
+    template <typename T>
+    T LittleEndian(T value);
+}
+
+#include "LittleEndian.tcc"
+
+#endif // LIBRCSSCONTROLLER_LITTLEENDIAN_H_
@@ -0,0 +1,39 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace librcsscontroller
+{
+    template <typename T>
+    T LittleEndian(T value)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        // Swapping through a byte array also works for floating point types
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        for (size_t i = 0; i < sizeof(T) / 2; ++i)
+        {
+            unsigned char b = bytes[i];
+            bytes[i] = bytes[sizeof(T) - 1 - i];
+            bytes[sizeof(T) - 1 - i] = b;
+        }
+        std::memcpy(&value, bytes, sizeof(T));
+#endif
+        return value;
+    }
+}
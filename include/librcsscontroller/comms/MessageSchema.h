@@ -0,0 +1,205 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_MESSAGESCHEMA_H_
+#define LIBRCSSCONTROLLER_MESSAGESCHEMA_H_
+
+#include "StringViewParser.h"
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace librcsscontroller
+{
+    /**
+     *  A SchemaField names one member of a message type. It pairs the key
+     *  used on the wire with a pointer to the member holding the value.
+     *
+     *  @tparam TClass The message type.
+     *  @tparam T The type of the member.
+     */
+    template <typename TClass, typename T>
+    struct SchemaField
+    {
+        std::string_view key;   /**< The key used on the wire */
+        T TClass::* member;     /**< The member holding the value */
+    };
+
+    /**
+     *  Creates a SchemaField, deducing its types from the member pointer.
+     *
+     *  @param key The key used on the wire.
+     *  @param member The member holding the value.
+     *  @return SchemaField The new SchemaField.
+     */
+    template <typename TClass, typename T>
+    constexpr SchemaField<TClass, T> MakeField(std::string_view key,
+                                               T TClass::* member);
+
+    /**
+     *  The MessageSchema class generates the text codec of a message type from
+     *  a list of its fields. Messages are symbolic expressions of key/value
+     *  pairs:
+     *
+     *      ((key1 value1)(key2 value2)...)
+     *
+     *  Keys are looked up with a perfect hash computed when the schema is
+     *  constructed, so a constexpr schema costs nothing at runtime. Decoding
+     *  accepts fields in any order and skips unknown keys. Fields missing
+     *  from a message keep their previous values.
+     *
+     *  Supported member types are arithmetic types, bool (written as 0 or 1)
+     *  and std::string (a single word).
+     *
+     *  @tparam TClass The message type.
+     *  @tparam TFields The types of the schema's fields, in order.
+     */
+    template <typename TClass, typename... TFields>
+    class MessageSchema
+    {
+    public:
+        /**
+         *  The number of fields in the schema.
+         */
+        constexpr static size_t FIELD_COUNT = sizeof...(TFields);
+
+        /**
+         *  Constructor. Fails to compile when used in a constant expression
+         *  with duplicate keys.
+         *
+         *  @param fields The fields of the message type, in the order they
+         *  are encoded.
+         */
+        constexpr explicit MessageSchema(SchemaField<TClass, TFields>... fields);
+
+        /**
+         *  Encodes a message. The string's existing capacity is reused.
+         *
+         *  @param message The message to encode.
+         *  @param out[out] The string to write the encoded message to.
+         */
+        void Encode(const TClass& message, std::string* out) const;
+
+        /**
+         *  Decodes a message. Fields may be in any order, and unknown keys
+         *  are skipped, but every field of the schema must be present.
+         *
+         *  @param received The encoded message.
+         *  @param message[out] The message to populate.
+         *  @return bool True indicates success. False indicates the message
+         *  was malformed, a value could not be read or a field was missing.
+         */
+        bool Decode(std::string_view received, TClass* message) const;
+
+        /**
+         *  Finds the field with the specified key.
+         *
+         *  @param key The key to look up.
+         *  @return int The index of the field, or -1 if no field has the key.
+         */
+        constexpr int Find(std::string_view key) const;
+
+    private:
+        /**
+         *  The number of slots in the hash table. Keeping the table at least
+         *  twice the number of fields makes a collision-free seed quick to
+         *  find.
+         */
+        constexpr static size_t TABLE_SIZE = [] {
+            size_t size = 1;
+            while (size < 2 * FIELD_COUNT)
+            {
+                size *= 2;
+            }
+            return size;
+        }();
+
+        /**
+         *  The number of seeds tried before giving up on a perfect hash.
+         */
+        constexpr static uint32_t MAX_SEEDS = 4096;
+
+        /**
+         *  Hashes a key (FNV-1a, with the seed mixed into the offset basis).
+         *
+         *  @param key The key to hash.
+         *  @param seed The seed to hash with.
+         *  @return uint32_t The hash of the key.
+         */
+        constexpr static uint32_t Hash(std::string_view key, uint32_t seed);
+
+        /**
+         *  Attempts to fill the hash table without collisions.
+         *
+         *  @param seed The seed to hash with.
+         *  @return bool True if no two keys share a slot.
+         */
+        constexpr bool TryBuild(uint32_t seed);
+
+        /**
+         *  Appends every field of a message, in order.
+         */
+        template <size_t... Is>
+        void EncodeFields(const TClass& message, std::string* out,
+                          std::index_sequence<Is...>) const;
+
+        /**
+         *  Reads the value of the field with the specified index, followed by
+         *  its closing ')'.
+         */
+        template <size_t... Is>
+        bool DecodeField(size_t index, StringViewParser* msg, TClass* message,
+                         std::index_sequence<Is...>) const;
+
+        /**
+         *  Appends a value in its text form.
+         */
+        static void AppendValue(bool value, std::string* out);
+        static void AppendValue(const std::string& value, std::string* out);
+        template <typename T>
+        static void AppendValue(const T& value, std::string* out);
+
+        std::tuple<SchemaField<TClass, TFields>...> fields_;    /**< The fields, in encoding order */
+        std::array<std::string_view, FIELD_COUNT> keys_;        /**< The field keys, in encoding order */
+        std::array<uint8_t, TABLE_SIZE> table_;                 /**< Field index + 1 per hash slot, 0 if empty */
+        uint32_t seed_;                                         /**< The seed of the perfect hash */
+    };
+
+    /**
+     *  Creates a MessageSchema, deducing its types from the fields.
+     *
+     *  @param fields The fields of the message type, in the order they are
+     *  encoded.
+     *  @return MessageSchema The new MessageSchema.
+     */
+    template <typename TClass, typename... TFields>
+    constexpr MessageSchema<TClass, TFields...> MakeMessageSchema(
+        SchemaField<TClass, TFields>... fields);
+}
+
+#include "MessageSchema.tcc"
+
+#endif // LIBRCSSCONTROLLER_MESSAGESCHEMA_H_
@@ -0,0 +1,218 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace librcsscontroller
+{
+    template <typename TClass, typename T>
+    constexpr SchemaField<TClass, T> MakeField(std::string_view key,
+                                               T TClass::* member)
+    {
+        return SchemaField<TClass, T>{key, member};
+    }
+
+    template <typename TClass, typename... TFields>
+    constexpr MessageSchema<TClass, TFields...>::MessageSchema(
+        SchemaField<TClass, TFields>... fields)
+        : fields_{fields...}, keys_{{fields.key...}}, table_{}, seed_{0}
+    {
+        static_assert(FIELD_COUNT < 256, "Too many fields for the hash table");
+
+        for (size_t i = 0; i < FIELD_COUNT; ++i)
+        {
+            for (size_t j = i + 1; j < FIELD_COUNT; ++j)
+            {
+                if (keys_[i] == keys_[j])
+                {
+                    throw "MessageSchema: duplicate key";
+                }
+            }
+        }
+
+        while (!TryBuild(seed_))
+        {
+            if (++seed_ == MAX_SEEDS)
+            {
+                throw "MessageSchema: no perfect hash found";
+            }
+        }
+    }
+
+    template <typename TClass, typename... TFields>
+    void MessageSchema<TClass, TFields...>::Encode(const TClass& message,
+                                                   std::string* out) const
+    {
+        out->clear();
+        out->push_back('(');
+        EncodeFields(message, out, std::index_sequence_for<TFields...>());
+        out->push_back(')');
+    }
+
+    template <typename TClass, typename... TFields>
+    bool MessageSchema<TClass, TFields...>::Decode(std::string_view received,
+                                                   TClass* message) const
+    {
+        StringViewParser msg(received);
+        if (!msg.ReadOpen())
+        {
+            return false;
+        }
+
+        // Every field must be present, as a message missing one would leave
+        // stale values in the message being populated
+        std::array<bool, FIELD_COUNT> seen = {};
+        char c = 0;
+        while (msg.ReadType(&c) && c == '(')
+        {
+            std::string_view key;
+            if (!msg.ReadType(&key))
+            {
+                return false;
+            }
+
+            int index = Find(key);
+            bool ok = index < 0
+                ? msg.SkipToClose()
+                : DecodeField(index, &msg, message,
+                              std::index_sequence_for<TFields...>());
+            if (!ok)
+            {
+                return false;
+            }
+            if (index >= 0)
+            {
+                seen[index] = true;
+            }
+        }
+        if (c != ')')
+        {
+            return false;
+        }
+        for (bool found : seen)
+        {
+            if (!found)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename TClass, typename... TFields>
+    constexpr int MessageSchema<TClass, TFields...>::Find(
+        std::string_view key) const
+    {
+        uint8_t slot = table_[Hash(key, seed_) & (TABLE_SIZE - 1)];
+        if (slot == 0 || keys_[slot - 1] != key)
+        {
+            return -1;
+        }
+        return slot - 1;
+    }
+
+    template <typename TClass, typename... TFields>
+    constexpr uint32_t MessageSchema<TClass, TFields...>::Hash(
+        std::string_view key, uint32_t seed)
+    {
+        uint32_t hash = 2166136261u ^ (seed * 16777619u);
+        for (char c : key)
+        {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+        }
+        return hash ^ (hash >> 16);
+    }
+
+    template <typename TClass, typename... TFields>
+    constexpr bool MessageSchema<TClass, TFields...>::TryBuild(uint32_t seed)
+    {
+        for (size_t i = 0; i < TABLE_SIZE; ++i)
+        {
+            table_[i] = 0;
+        }
+        for (size_t i = 0; i < FIELD_COUNT; ++i)
+        {
+            uint8_t& slot = table_[Hash(keys_[i], seed) & (TABLE_SIZE - 1)];
+            if (slot != 0)
+            {
+                return false;
+            }
+            slot = static_cast<uint8_t>(i + 1);
+        }
+        return true;
+    }
+
+    template <typename TClass, typename... TFields>
+    template <size_t... Is>
+    void MessageSchema<TClass, TFields...>::EncodeFields(
+        const TClass& message, std::string* out,
+        std::index_sequence<Is...>) const
+    {
+        ((out->push_back('('),
+          out->append(std::get<Is>(fields_).key),
+          out->push_back(' '),
+          AppendValue(message.*(std::get<Is>(fields_).member), out),
+          out->push_back(')')), ...);
+    }
+
+    template <typename TClass, typename... TFields>
+    template <size_t... Is>
+    bool MessageSchema<TClass, TFields...>::DecodeField(
+        size_t index, StringViewParser* msg, TClass* message,
+        std::index_sequence<Is...>) const
+    {
+        bool ok = false;
+        ((index == Is
+          && (ok = msg->ReadVal(&(message->*(std::get<Is>(fields_).member))),
+              true)) || ...);
+        return ok;
+    }
+
+    template <typename TClass, typename... TFields>
+    void MessageSchema<TClass, TFields...>::AppendValue(bool value,
+                                                        std::string* out)
+    {
+        out->push_back(value ? '1' : '0');
+    }
+
+    template <typename TClass, typename... TFields>
+    void MessageSchema<TClass, TFields...>::AppendValue(
+        const std::string& value, std::string* out)
+    {
+        out->append(value);
+    }
+
+    template <typename TClass, typename... TFields>
+    template <typename T>
+    void MessageSchema<TClass, TFields...>::AppendValue(const T& value,
+                                                        std::string* out)
+    {
+        static_assert(std::is_arithmetic<T>::value,
+                      "MessageSchema fields must be arithmetic, bool or std::string");
+
+        char buffer[64];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out->append(buffer, result.ptr);
+    }
+
+    template <typename TClass, typename... TFields>
+    constexpr MessageSchema<TClass, TFields...> MakeMessageSchema(
+        SchemaField<TClass, TFields>... fields)
+    {
+        return MessageSchema<TClass, TFields...>(fields...);
+    }
+}
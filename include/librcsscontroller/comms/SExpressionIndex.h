@@ -0,0 +1,319 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_SEXPRESSIONINDEX_H_
+#define LIBRCSSCONTROLLER_SEXPRESSIONINDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace librcsscontroller
+{
+    /**
+     *  The SExpressionIndex class splits a symbolic expression message into a
+     *  flat list of tokens: '(' and ')' and atoms (runs of characters
+     *  delimited by whitespace or parentheses).
+     *
+     *  The message is classified 64 bytes at a time into bitmasks of
+     *  parentheses and whitespace, using AVX2 or SSE2 when the compiler
+     *  targets them and a scalar loop otherwise. Tokens are then read off the
+     *  bitmasks, so the cost is dominated by the number of tokens rather than
+     *  the number of bytes.
+     *
+     *  Tokens refer to the indexed message, which must outlive the index.
+     *  The token list is reused between messages.
+     */
+    class SExpressionIndex
+    {
+    public:
+        /**
+         *  A token in the indexed message.
+         */
+        struct Token
+        {
+            uint32_t offset;    /**< The position of the token in the message */
+            uint32_t length;    /**< The length of the token, 1 for parentheses */
+        };
+
+        /**
+         *  Indexes a message, replacing the previous index.
+         *
+         *  @param msg The message to index.
+         *  @return bool True indicates success. False indicates the message's
+         *  parentheses are unbalanced. Tokens are indexed either way.
+         */
+        bool Build(std::string_view msg)
+        {
+            msg_ = msg;
+            tokens_.clear();
+            atom_start_ = 0;
+            in_atom_ = false;
+            depth_ = 0;
+            balanced_ = true;
+
+            size_t pos = 0;
+            for (; pos + BLOCK_SIZE <= msg.size(); pos += BLOCK_SIZE)
+            {
+                ScanBlock(msg.data() + pos, pos);
+            }
+            if (pos < msg.size())
+            {
+                // Pad the final block with whitespace, which ends any atom
+                char tail[BLOCK_SIZE];
+                std::memset(tail, ' ', BLOCK_SIZE);
+                std::memcpy(tail, msg.data() + pos, msg.size() - pos);
+                ScanBlock(tail, pos);
+            }
+            if (in_atom_)
+            {
+                tokens_.push_back(Token{atom_start_, 
+                    static_cast<uint32_t>(msg.size() - atom_start_)});
+            }
+            return balanced_ && depth_ == 0;
+        }
+
+        /**
+         *  Returns the number of tokens in the index.
+         *
+         *  @return size_t The number of tokens.
+         */
+        size_t Size() const
+        {
+            return tokens_.size();
+        }
+
+        /**
+         *  Returns the text of a token.
+         *
+         *  @param i The index of the token.
+         *  @return std::string_view The token's text.
+         */
+        std::string_view Text(const size_t i) const
+        {
+            return msg_.substr(tokens_[i].offset, tokens_[i].length);
+        }
+
+        /**
+         *  Indicates whether a token is an opening '('.
+         *
+         *  @param i The index of the token.
+         *  @return bool True if the token is '('.
+         */
+        bool IsOpen(const size_t i) const
+        {
+            return msg_[tokens_[i].offset] == '(';
+        }
+
+        /**
+         *  Indicates whether a token is a closing ')'.
+         *
+         *  @param i The index of the token.
+         *  @return bool True if the token is ')'.
+         */
+        bool IsClose(const size_t i) const
+        {
+            return msg_[tokens_[i].offset] == ')';
+        }
+
+        /**
+         *  Indicates whether a token is an atom.
+         *
+         *  @param i The index of the token.
+         *  @return bool True if the token is neither '(' nor ')'.
+         */
+        bool IsAtom(const size_t i) const
+        {
+            return !IsOpen(i) && !IsClose(i);
+        }
+
+    private:
+        /**
+         *  The number of bytes classified at once, one per bit of a mask.
+         */
+        constexpr static size_t BLOCK_SIZE = 64;
+
+        /**
+         *  Bitmasks classifying each byte of a block.
+         */
+        struct Masks
+        {
+            uint64_t open;      /**< Bytes that are '(' */
+            uint64_t close;     /**< Bytes that are ')' */
+            uint64_t space;     /**< Bytes that are whitespace */
+        };
+
+#if defined(__AVX2__)
+        /**
+         *  Classifies a 64-byte block, 32 bytes at a time.
+         *
+         *  @param data The block to classify.
+         *  @return Masks The classification of each byte.
+         */
+        static Masks Classify(const char* data)
+        {
+            Masks m = {0, 0, 0};
+            for (int half = 0; half < 2; ++half)
+            {
+                __m256i v = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(data + 32 * half));
+                __m256i space = _mm256_or_si256(
+                    _mm256_or_si256(
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+                    _mm256_or_si256(
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+                int shift = 32 * half;
+                m.open |= static_cast<uint64_t>(static_cast<uint32_t>(
+                    _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,
+                        _mm256_set1_epi8('('))))) << shift;
+                m.close |= static_cast<uint64_t>(static_cast<uint32_t>(
+                    _mm256_movemask_epi8(_mm256_cmpeq_epi8(v,
+                        _mm256_set1_epi8(')'))))) << shift;
+                m.space |= static_cast<uint64_t>(static_cast<uint32_t>(
+                    _mm256_movemask_epi8(space))) << shift;
+            }
+            return m;
+        }
+#elif defined(__SSE2__)
+        /**
+         *  Classifies a 64-byte block, 16 bytes at a time.
+         *
+         *  @param data The block to classify.
+         *  @return Masks The classification of each byte.
+         */
+        static Masks Classify(const char* data)
+        {
+            Masks m = {0, 0, 0};
+            for (int quarter = 0; quarter < 4; ++quarter)
+            {
+                __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(data + 16 * quarter));
+                __m128i space = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+                int shift = 16 * quarter;
+                m.open |= static_cast<uint64_t>(_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(v, _mm_set1_epi8('(')))) << shift;
+                m.close |= static_cast<uint64_t>(_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(v, _mm_set1_epi8(')')))) << shift;
+                m.space |= static_cast<uint64_t>(_mm_movemask_epi8(space))
+                    << shift;
+            }
+            return m;
+        }
+#else
+        /**
+         *  Classifies a 64-byte block, one byte at a time.
+         *
+         *  @param data The block to classify.
+         *  @return Masks The classification of each byte.
+         */
+        static Masks Classify(const char* data)
+        {
+            Masks m = {0, 0, 0};
+            for (size_t i = 0; i < BLOCK_SIZE; ++i)
+            {
+                uint64_t bit = uint64_t(1) << i;
+                char c = data[i];
+                if (c == '(')
+                {
+                    m.open |= bit;
+                }
+                else if (c == ')')
+                {
+                    m.close |= bit;
+                }
+                else if (c == ' ' || c == '\n' || c == '\t' || c == '\r')
+                {
+                    m.space |= bit;
+                }
+            }
+            return m;
+        }
+#endif
+
+        /**
+         *  Appends the tokens that start or end within a block.
+         *
+         *  @param data The block to scan, BLOCK_SIZE bytes long.
+         *  @param base The position of the block in the message.
+         */
+        void ScanBlock(const char* data, const size_t base)
+        {
+            Masks m = Classify(data);
+            uint64_t atom = ~(m.open | m.close | m.space);
+
+            // An atom starts where the previous byte was not part of an atom,
+            // and ends at the first byte after it that is not.
+            uint64_t before = (atom << 1) | (in_atom_ ? 1 : 0);
+            uint64_t starts = atom & ~before;
+            uint64_t ends = ~atom & before;
+
+            uint64_t events = starts | ends | m.open | m.close;
+            while (events != 0)
+            {
+                int i = __builtin_ctzll(events);
+                uint64_t bit = uint64_t(1) << i;
+                events &= events - 1;
+                uint32_t pos = static_cast<uint32_t>(base + i);
+
+                if (ends & bit)
+                {
+                    tokens_.push_back(Token{atom_start_, pos - atom_start_});
+                }
+                if (m.open & bit)
+                {
+                    tokens_.push_back(Token{pos, 1});
+                    ++depth_;
+                }
+                else if (m.close & bit)
+                {
+                    tokens_.push_back(Token{pos, 1});
+                    balanced_ = balanced_ && depth_-- > 0;
+                }
+                else if (starts & bit)
+                {
+                    atom_start_ = pos;
+                }
+            }
+            in_atom_ = (atom >> (BLOCK_SIZE - 1)) & 1;
+        }
+
+        std::string_view msg_;          /**< The indexed message */
+        std::vector<Token> tokens_;     /**< The tokens, in message order */
+        uint32_t atom_start_;           /**< The start of the atom being scanned */
+        bool in_atom_;                  /**< Indicates the previous block ended inside an atom */
+        int depth_;                     /**< The current nesting depth */
+        bool balanced_;                 /**< False once a ')' had no matching '(' */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_SEXPRESSIONINDEX_H_
@@ -0,0 +1,276 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_SHAREDMEMORYCHANNEL_H_
+#define LIBRCSSCONTROLLER_SHAREDMEMORYCHANNEL_H_
+
+#include "SharedMemoryRing.h"
+
+#include <atomic>
+#include <cstddef>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace librcsscontroller
+{
+    /**
+     *  The SharedMemoryChannel class connects a controller with one agent on
+     *  the same machine through a named POSIX shared memory object, holding
+     *  one SharedMemoryRing in each direction.
+     *
+     *  The controller creates the channel with Create(). An agent claims it
+     *  with Open(), which empties both rings and marks the channel attached,
+     *  and gives it back with Close(). Like EndpointConnection, a channel is
+     *  a handle that can be copied; the mapping is only released by Close()
+     *  or Destroy().
+     */
+    class SharedMemoryChannel
+    {
+    public:
+        /**
+         *  The number of bytes each ring can hold.
+         */
+        constexpr static size_t RING_CAPACITY = 1 << 16;
+
+        /**
+         *  Constructor
+         */
+        SharedMemoryChannel()
+            : control_{nullptr}, size_{0}
+        { }
+
+        /**
+         *  Creates and maps the shared memory object for a channel. Called by
+         *  the controller.
+         *
+         *  @param name The name of the shared memory object, e.g. "/agent.1".
+         *  @return bool True indicates success. False indicates failure.
+         */
+        bool Create(const std::string& name)
+        {
+            name_ = name;
+            shm_unlink(name.c_str());
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+            if (fd < 0)
+            {
+                return false;
+            }
+
+            bool mapped = ftruncate(fd, GetSize()) == 0 && Map(fd);
+            close(fd);
+            if (!mapped)
+            {
+                shm_unlink(name.c_str());
+                return false;
+            }
+
+            to_controller_.Reset();
+            to_agent_.Reset();
+            control_->attached.store(FREE, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         *  Maps a channel created by a controller, and claims it. Called by 
+         *  the agent.
+         *
+         *  @param name The name of the shared memory object.
+         *  @return bool True indicates success. False indicates the channel
+         *  does not exist or is already claimed.
+         */
+        bool Open(const std::string& name)
+        {
+            name_ = name;
+            int fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0)
+            {
+                return false;
+            }
+            bool mapped = Map(fd);
+            close(fd);
+            if (!mapped)
+            {
+                return false;
+            }
+
+            uint32_t expected = FREE;
+            if (!control_->attached.compare_exchange_strong(expected, CLAIMING))
+            {
+                Unmap();
+                return false;
+            }
+
+            // The controller ignores the rings until the channel is attached
+            to_controller_.Reset();
+            to_agent_.Reset();
+            control_->attached.store(ATTACHED, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         *  Gives the channel back to the controller and unmaps it. Called by
+         *  the agent.
+         */
+        void Close()
+        {
+            if (control_)
+            {
+                Release();
+                Unmap();
+            }
+        }
+
+        /**
+         *  Unmaps and removes the shared memory object. Called by the 
+         *  controller.
+         */
+        void Destroy()
+        {
+            if (control_)
+            {
+                Unmap();
+                shm_unlink(name_.c_str());
+            }
+        }
+
+        /**
+         *  Marks the channel as free, so another agent may claim it. The 
+         *  controller calls this when dropping the agent.
+         */
+        void Release()
+        {
+            // Leaves a channel that is being claimed alone
+            uint32_t expected = ATTACHED;
+            control_->attached.compare_exchange_strong(expected, FREE);
+        }
+
+        /**
+         *  Indicates whether an agent has claimed the channel.
+         *
+         *  @return bool True if an agent is attached. False otherwise.
+         */
+        bool IsAttached() const
+        {
+            return control_ && 
+                control_->attached.load(std::memory_order_acquire) == ATTACHED;
+        }
+
+        /**
+         *  Returns the ring carrying messages from the agent to the 
+         *  controller.
+         *
+         *  @return SharedMemoryRing& The ring.
+         */
+        SharedMemoryRing& ToController()
+        {
+            return to_controller_;
+        }
+
+        /**
+         *  Returns the ring carrying messages from the controller to the
+         *  agent.
+         *
+         *  @return SharedMemoryRing& The ring.
+         */
+        SharedMemoryRing& ToAgent()
+        {
+            return to_agent_;
+        }
+
+    private:
+        /**
+         *  Values of the attached flag.
+         */
+        enum Attached : uint32_t {FREE, CLAIMING, ATTACHED};
+
+        /**
+         *  The start of the shared memory object, followed by the ring to
+         *  the controller and then the ring to the agent.
+         */
+        struct Control
+        {
+            alignas(64) std::atomic<uint32_t> attached;
+        };
+
+        /**
+         *  Returns the size of the shared memory object.
+         *
+         *  @return size_t The size in bytes.
+         */
+        static size_t GetSize()
+        {
+            return sizeof(Control) + 2 * RingStride();
+        }
+
+        /**
+         *  Returns the space taken by each ring, keeping the second ring 
+         *  aligned.
+         *
+         *  @return size_t The size in bytes.
+         */
+        static size_t RingStride()
+        {
+            return (SharedMemoryRing::GetSize(RING_CAPACITY) + 63) / 64 * 64;
+        }
+
+        /**
+         *  Maps the shared memory object and places the rings in it.
+         *
+         *  @param fd The shared memory object's file descriptor.
+         *  @return bool True indicates success. False indicates failure.
+         */
+        bool Map(const int fd)
+        {
+            void* memory = mmap(nullptr, GetSize(), PROT_READ | PROT_WRITE, 
+                                MAP_SHARED, fd, 0);
+            if (memory == MAP_FAILED)
+            {
+                return false;
+            }
+
+            char* base = static_cast<char*>(memory);
+            control_ = static_cast<Control*>(memory);
+            size_ = GetSize();
+            to_controller_.Init(base + sizeof(Control), RING_CAPACITY);
+            to_agent_.Init(base + sizeof(Control) + RingStride(), RING_CAPACITY);
+            return true;
+        }
+
+        /**
+         *  Unmaps the shared memory object.
+         */
+        void Unmap()
+        {
+            munmap(control_, size_);
+            control_ = nullptr;
+        }
+
+        std::string name_;                  /**< The name of the shared memory object */
+        Control* control_;                  /**< The mapped shared memory object */
+        size_t size_;                       /**< The size of the mapping */
+        SharedMemoryRing to_controller_;    /**< Carries messages from the agent */
+        SharedMemoryRing to_agent_;         /**< Carries messages to the agent */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_SHAREDMEMORYCHANNEL_H_
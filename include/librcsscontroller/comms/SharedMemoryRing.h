@@ -0,0 +1,196 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_SHAREDMEMORYRING_H_
+#define LIBRCSSCONTROLLER_SHAREDMEMORYRING_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+namespace librcsscontroller
+{
+    /**
+     *  The SharedMemoryRing class passes messages from one writer to one
+     *  reader through a byte ring placed in memory shared between processes.
+     *  Neither side makes system calls or takes locks.
+     *
+     *  Each message is stored as a 4-byte host order length followed by the
+     *  message, and may wrap around the end of the ring. The ring only
+     *  describes memory owned by someone else, so it can be freely copied.
+     */
+    class SharedMemoryRing
+    {
+    public:
+        /**
+         *  Constructor
+         */
+        SharedMemoryRing()
+            : header_{nullptr}, data_{nullptr}, capacity_{0}
+        { }
+
+        /**
+         *  Returns the amount of shared memory needed by a ring.
+         *
+         *  @param capacity The number of bytes the ring can hold.
+         *  @return size_t The size of the ring in shared memory.
+         */
+        static size_t GetSize(const size_t capacity)
+        {
+            return sizeof(Header) + capacity;
+        }
+
+        /**
+         *  Places the ring in shared memory.
+         *
+         *  @param memory The shared memory to use. Must be at least 
+         *  GetSize(capacity) bytes, and suitably aligned.
+         *  @param capacity The number of bytes the ring can hold.
+         */
+        void Init(void* memory, const size_t capacity)
+        {
+            header_ = static_cast<Header*>(memory);
+            data_ = static_cast<char*>(memory) + sizeof(Header);
+            capacity_ = capacity;
+        }
+
+        /**
+         *  Empties the ring. Must only be called while neither side is using
+         *  it.
+         */
+        void Reset()
+        {
+            header_->write_pos.store(0, std::memory_order_relaxed);
+            header_->read_pos.store(0, std::memory_order_release);
+        }
+
+        /**
+         *  Adds a message to the ring. Must only be called by the writer.
+         *
+         *  @param message The message to add.
+         *  @param size The size of the message.
+         *  @return bool True if the message was added. False if there is not
+         *  enough free space, in which case nothing is added.
+         */
+        bool Write(const char* message, const size_t size)
+        {
+            uint64_t write = header_->write_pos.load(std::memory_order_relaxed);
+            uint64_t read = header_->read_pos.load(std::memory_order_acquire);
+            if (size > UINT32_MAX || 
+                capacity_ - (write - read) < HEADER_LEN + size)
+            {
+                return false;
+            }
+
+            uint32_t len = static_cast<uint32_t>(size);
+            Copy(write, reinterpret_cast<const char*>(&len), HEADER_LEN);
+            Copy(write + HEADER_LEN, message, size);
+            header_->write_pos.store(write + HEADER_LEN + size, 
+                                     std::memory_order_release);
+            return true;
+        }
+
+        /**
+         *  Removes the oldest message from the ring. Must only be called by
+         *  the reader.
+         *
+         *  @param out[out] The string to write the message to.
+         *  @return bool True if a message was removed. False if the ring is
+         *  empty, or holds a malformed message.
+         */
+        bool Read(std::string* out)
+        {
+            uint64_t read = header_->read_pos.load(std::memory_order_relaxed);
+            uint64_t write = header_->write_pos.load(std::memory_order_acquire);
+            if (write - read < HEADER_LEN)
+            {
+                return false;
+            }
+
+            uint32_t len;
+            Extract(read, reinterpret_cast<char*>(&len), HEADER_LEN);
+            if (write - read < HEADER_LEN + len)
+            {
+                return false;
+            }
+
+            out->resize(len);
+            Extract(read + HEADER_LEN, &(*out)[0], len);
+            header_->read_pos.store(read + HEADER_LEN + len, 
+                                    std::memory_order_release);
+            return true;
+        }
+
+    private:
+        /**
+         *  The size of the length stored before each message.
+         */
+        constexpr static size_t HEADER_LEN = 4;
+
+        /**
+         *  The positions of the writer and reader. They only ever increase,
+         *  and are kept on separate cache lines so the two sides do not 
+         *  contend.
+         */
+        struct Header
+        {
+            alignas(64) std::atomic<uint64_t> write_pos;
+            alignas(64) std::atomic<uint64_t> read_pos;
+        };
+
+        /**
+         *  Copies bytes into the ring, wrapping around its end.
+         *
+         *  @param pos The position to copy to.
+         *  @param from The bytes to copy.
+         *  @param size The number of bytes to copy.
+         */
+        void Copy(const uint64_t pos, const char* from, const size_t size)
+        {
+            size_t start = pos % capacity_;
+            size_t first = std::min(size, capacity_ - start);
+            std::memcpy(data_ + start, from, first);
+            std::memcpy(data_, from + first, size - first);
+        }
+
+        /**
+         *  Copies bytes out of the ring, wrapping around its end.
+         *
+         *  @param pos The position to copy from.
+         *  @param to The location to copy to.
+         *  @param size The number of bytes to copy.
+         */
+        void Extract(const uint64_t pos, char* to, const size_t size) const
+        {
+            size_t start = pos % capacity_;
+            size_t first = std::min(size, capacity_ - start);
+            std::memcpy(to, data_ + start, first);
+            std::memcpy(to + first, data_, size - first);
+        }
+
+        Header* header_;    /**< The positions, in shared memory */
+        char* data_;        /**< The ring's bytes, in shared memory */
+        size_t capacity_;   /**< The number of bytes the ring can hold */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_SHAREDMEMORYRING_H_
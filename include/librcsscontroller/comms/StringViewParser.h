@@ -0,0 +1,322 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_STRINGVIEWPARSER_H_
+#define LIBRCSSCONTROLLER_STRINGVIEWPARSER_H_
+
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace librcsscontroller
+{
+    /**
+     *  StringViewParser provides the same interface as MessageParser, but
+     *  reads directly from the message with a cursor instead of copying it
+     *  into a stringstream. Keys are compared in place and numbers are
+     *  converted with std::from_chars, so parsing never allocates.
+     *
+     *  The parsed message is not copied, so it must outlive the parser.
+     */
+    class StringViewParser
+    {
+    public:
+        /**
+         *  Constructor
+         *
+         *  @param msg The message to parse.
+         */
+        StringViewParser(std::string_view msg)
+            : msg_{msg}, pos_{0}, good_{true}
+        { }
+
+        /**
+         *  Returns the underlying message being parsed.
+         *
+         *  @return std::string_view The underlying message being parsed.
+         */
+        std::string_view GetString() const
+        {
+            return msg_;
+        }
+
+        /**
+         *  Attempts to read a number from the message.
+         *
+         *  @tparam T The arithmetic type to read.
+         *  @param out[out] The location to save the number to.
+         *  @return bool Returns true if the number was successfully read.
+         *  Otherwise returns false.
+         */
+        template<typename T> bool ReadType(T* out);
+
+        /**
+         *  Attempts to read a boolean, written as 0 or 1, from the message.
+         *
+         *  @param out[out] The location to save the boolean to.
+         *  @return bool Returns true if the boolean was successfully read.
+         *  Otherwise returns false.
+         */
+        bool ReadType(bool* out)
+        {
+            int value;
+            if (!ReadType(&value))
+            {
+                return false;
+            }
+            *out = value != 0;
+            return true;
+        }
+
+        /**
+         *  Attempts to read a single non-whitespace character from the
+         *  message.
+         *
+         *  @param out[out] The location to save the character to.
+         *  @return bool Returns true if the character was successfully read.
+         *  Otherwise returns false.
+         */
+        bool ReadType(char* out)
+        {
+            SkipSpace();
+            if (pos_ >= msg_.size())
+            {
+                return Fail();
+            }
+            *out = msg_[pos_++];
+            return true;
+        }
+
+        /**
+         *  Attempts to read a word from the message. The word is not copied,
+         *  and refers to the underlying message.
+         *
+         *  @param out[out] The location to save the word to.
+         *  @return bool Returns true if the word was successfully read.
+         *  Otherwise returns false.
+         */
+        bool ReadType(std::string_view* out)
+        {
+            return ReadWord(out);
+        }
+
+        /**
+         *  Attempts to read a word from the message. The string's existing
+         *  capacity is reused.
+         *
+         *  @param out[out] The string to write the word to.
+         *  @return bool Returns true if the word was successfully read.
+         *  Otherwise returns false.
+         */
+        bool ReadType(std::string* out)
+        {
+            std::string_view word;
+            if (!ReadWord(&word))
+            {
+                return false;
+            }
+            out->assign(word.data(), word.size());
+            return true;
+        }
+
+        /**
+         *  Attempts to read the next word from the message, skipping over any
+         *  parentheses in front of it.
+         *
+         *  @param out[out] The location to save the word to.
+         *  @return bool Returns true if the word was successfully read.
+         *  False otherwise.
+         */
+        bool ReadDelimitedWord(std::string_view* out)
+        {
+            while (pos_ < msg_.size() && (IsSpace(msg_[pos_])
+                   || msg_[pos_] == '(' || msg_[pos_] == ')'))
+            {
+                ++pos_;
+            }
+            return ReadWord(out);
+        }
+
+        /**
+         *  Attempts to read a symbolic expression openning '('.
+         *
+         *  @return bool True if an openning '(' was read. False otherwise.
+         */
+        bool ReadOpen()
+        {
+            return ReadChar('(');
+        }
+
+        /**
+         *  Attempts to read a symbolic expression closing ')'.
+         *
+         *  @return bool True if a closing ')' was read. False otherwise.
+         */
+        bool ReadClose()
+        {
+            return ReadChar(')');
+        }
+
+        /**
+         *  Attempts to read an expected symbolic expression key.
+         *
+         *  @param expected The expected key to be read.
+         *  @return bool True if the expected key was read. False otherwise.
+         */
+        bool ReadKey(std::string_view expected)
+        {
+            std::string_view key;
+            return ReadOpen() && ReadWord(&key) && key == expected;
+        }
+
+        /**
+         *  Skips the rest of the current symbolic expression, including any
+         *  nested expressions, up to and including its closing ')'.
+         *
+         *  @return bool True if the closing ')' was found. False otherwise.
+         */
+        bool SkipToClose()
+        {
+            int depth = 0;
+            while (pos_ < msg_.size())
+            {
+                char c = msg_[pos_++];
+                if (c == '(')
+                {
+                    ++depth;
+                }
+                else if (c == ')' && depth-- == 0)
+                {
+                    return true;
+                }
+            }
+            return Fail();
+        }
+
+        /**
+         *  Attempts to read a symbolic expression value.
+         *
+         *  @tparam T The expected type of the value.
+         *  @param out[out] A pointer where the read value is stored.
+         *  @return bool True if the value was read. False otherwise.
+         */
+        template<typename T> bool ReadVal(T* out);
+
+        /**
+         *  Attempts to read a symbolic expression key and value pair.
+         *
+         *  @tparam T The expected type of the value.
+         *  @param expected_key The expected key to be read.
+         *  @param out[out] A pointer where the read value is stored.
+         *  @return bool True if the expected key and value was read. False
+         *  otherwise.
+         */
+        template<typename T>
+        bool ReadKeyVal(std::string_view expected_key, T* out);
+
+        /**
+         *  Indicates whether or not the StringViewParser can continue reading.
+         *
+         *  @return True if the StringViewParser can continue reading. False
+         *  otherwise.
+         */
+        bool IsGood() const
+        {
+            return good_ && pos_ < msg_.size();
+        }
+
+    private:
+        /**
+         *  Indicates whether a character separates words.
+         *
+         *  @param c The character to check.
+         *  @return bool True if c is whitespace.
+         */
+        static bool IsSpace(const char c)
+        {
+            return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+        }
+
+        /**
+         *  Advances the cursor past any whitespace.
+         */
+        void SkipSpace()
+        {
+            while (pos_ < msg_.size() && IsSpace(msg_[pos_]))
+            {
+                ++pos_;
+            }
+        }
+
+        /**
+         *  Marks the parser as failed.
+         *
+         *  @return bool Always false, for convenience.
+         */
+        bool Fail()
+        {
+            good_ = false;
+            return false;
+        }
+
+        /**
+         *  Attempts to read an expected character, after any whitespace.
+         *
+         *  @param expected The expected character.
+         *  @return bool True if the expected character was read.
+         */
+        bool ReadChar(const char expected)
+        {
+            char c;
+            return ReadType(&c) && (c == expected || Fail());
+        }
+
+        /**
+         *  Attempts to read a word, which ends at whitespace or a parenthesis.
+         *
+         *  @param out[out] The location to save the word to.
+         *  @return bool True if a non-empty word was read.
+         */
+        bool ReadWord(std::string_view* out)
+        {
+            SkipSpace();
+            size_t start = pos_;
+            while (pos_ < msg_.size() && !IsSpace(msg_[pos_])
+                   && msg_[pos_] != '(' && msg_[pos_] != ')')
+            {
+                ++pos_;
+            }
+            if (pos_ == start)
+            {
+                return Fail();
+            }
+            *out = msg_.substr(start, pos_ - start);
+            return true;
+        }
+
+        std::string_view msg_;  /**< The message being parsed */
+        size_t pos_;            /**< The position of the next unread character */
+        bool good_;             /**< False once a read has failed */
+    };
+}
+
+#include "StringViewParser.tcc"
+
+#endif // LIBRCSSCONTROLLER_STRINGVIEWPARSER_H_
@@ -0,0 +1,68 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace librcsscontroller
+{
+    template<typename T>
+    bool StringViewParser::ReadType(T* out)
+    {
+        SkipSpace();
+        const char* first = msg_.data() + pos_;
+        const char* last = msg_.data() + msg_.size();
+
+        // from_chars rejects the leading '+' that operator>> accepts
+        if (first != last && *first == '+')
+        {
+            ++first;
+        }
+
+        auto result = std::from_chars(first, last, *out);
+        if (result.ec != std::errc())
+        {
+            return Fail();
+        }
+        pos_ = result.ptr - msg_.data();
+        return true;
+    }
+
+    template<typename T>
+    bool StringViewParser::ReadVal(T* out)
+    {
+        if (!ReadType(out))
+        {
+            return false;
+        }
+
+        if (!ReadClose())
+        {
+            return false;
+        }
+        return true;
+    }
+
+    template<typename T>
+    bool StringViewParser::ReadKeyVal(std::string_view expected_key, T* out)
+    {
+        if (!ReadKey(expected_key))
+        {
+            return false;
+        }
+        return ReadVal(out);
+    }
+}
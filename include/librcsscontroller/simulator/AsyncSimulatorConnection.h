@@ -0,0 +1,973 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_ASYNCSIMULATORCONNECTION_H_
+#define LIBRCSSCONTROLLER_ASYNCSIMULATORCONNECTION_H_
+
+#include "comms/EndpointConnection.h"
+#include "comms/FrameBuffer.h"
+#include "comms/SExpressionIndex.h"
+#include "SceneGraph.h"
+#include "SimulatorConnection.h"
+#include "SimulatorSnapshot.h"
+#include "utils/SpscQueue.h"
+#include "utils/TripleBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace librcsscontroller 
+{
+    /**
+     *  The AsyncSimulatorConnection class provides the same interface as
+     *  SimulatorConnection, except that Tick() never blocks waiting for the
+     *  simulator. Messages that arrive split across several reads are
+     *  reassembled over successive ticks instead of being lost.
+     *
+     *  Simulator commands are queued rather than written immediately, and
+     *  Flush() sends everything queued as one message, since rcssserver3d
+     *  accepts concatenated commands. Commands superseded before the flush,
+     *  such as a second move of the same player, are dropped.
+     *
+     *  Each flushed batch ends with an acknowledgement request carrying the
+     *  batch's id, so callers can wait for their commands to be applied with
+     *  GetTicket() and IsAcknowledged(). A simulator that does not answer
+     *  acknowledgement requests is instead given a number of messages to
+     *  apply each batch in, chosen by the caller. A command identical to one
+     *  still awaiting its acknowledgement is not sent again.
+     *
+     *  By default all simulator I/O happens inside Tick() and Flush(). After
+     *  Start(), a dedicated thread owns the socket instead: it receives and
+     *  decodes messages as they arrive and publishes the latest snapshot,
+     *  while Flush() only hands the batch to it through a lock-free queue.
+     *  Tick() then just picks up the latest published state.
+     */
+    class AsyncSimulatorConnection 
+        : private SimulatorConnection
+    {
+    public:
+        /**
+         *  Constructor
+         */
+        AsyncSimulatorConnection()
+            : sockfd_{0}, epollfd_{0}, wakefd_{0}, notifyfd_{-1},
+              snapshot_{std::make_shared<const SimulatorSnapshot>()},
+              acked_batch_{0}, received_{0}, open_{true}, 
+              view_{&published_.Read()}, last_batch_{0}, 
+              ack_timeout_{ACK_TIMEOUT_MESSAGES}, last_received_{0}, 
+              updated_{false}, running_{false}
+        { }
+
+        /**
+         *  Destructor. Stops the I/O thread if it is running.
+         */
+        ~AsyncSimulatorConnection()
+        {
+            Stop();
+            if (epollfd_ > 0)
+            {
+                close(epollfd_);
+            }
+            if (wakefd_ > 0)
+            {
+                close(wakefd_);
+            }
+        }
+
+        /**
+         *  Initialises the AsyncSimulatorConnection. Must be called before
+         *  Start().
+         *
+         *  @param ep The underlying EndpointConnection to connect to the
+         *  simulator.
+         *  @return bool True indicates success.
+         */
+        bool Init(const EndpointConnection& ep)
+        {
+            sockfd_ = ep.GetId();
+            in_.Clear();
+            pending_.clear();
+            ack_timeout_ = ACK_TIMEOUT_MESSAGES;
+            in_flight_.clear();
+            acked_batch_ = last_batch_;
+            open_ = true;
+            Publish();
+            return SimulatorConnection::Init(ep);
+        }
+
+        /**
+         *  Starts running the simulator I/O on a dedicated thread. Afterwards
+         *  Tick() no longer touches the socket, Flush() hands batches to the
+         *  I/O thread, and the remaining member functions must all be called
+         *  from one thread.
+         *
+         *  @return bool True if the I/O thread was started. False otherwise.
+         */
+        bool Start()
+        {
+            if (running_ || !InitEpoll())
+            {
+                return false;
+            }
+            running_ = true;
+            io_thread_ = std::thread(&AsyncSimulatorConnection::Run, this);
+            return true;
+        }
+
+        /**
+         *  Sets an eventfd for the I/O thread to signal each time it publishes
+         *  new simulator state, so the thread calling Tick() can block until
+         *  there is something to pick up.
+         *
+         *  @param fd The eventfd to signal, or -1 for none.
+         */
+        void SetNotifyFd(const int fd)
+        {
+            notifyfd_ = fd;
+        }
+
+        /**
+         *  Stops the I/O thread started by Start(), returning all simulator
+         *  I/O to Tick() and Flush().
+         */
+        void Stop()
+        {
+            if (!running_)
+            {
+                return;
+            }
+            running_ = false;
+            Wake();
+            io_thread_.join();
+
+            // Send anything flushed just before stopping
+            HandleRequests();
+        }
+
+        /**
+         *  Receives every message the simulator has sent since the last tick,
+         *  without waiting for new messages.
+         *
+         *  When the I/O thread is running, this only picks up the latest
+         *  state it has published. No system calls or locks are involved.
+         *
+         *  @return bool True indicates success. False indicates the simulator
+         *  has disconnected or sent a malformed message.
+         */
+        bool Tick()
+        {
+            if (!running_)
+            {
+                Receive();
+            }
+            view_ = &published_.Read();
+            updated_ = view_->received != last_received_;
+            last_received_ = view_->received;
+            return view_->open;
+        }
+
+        /**
+         *  Indicates whether the last Tick() received a new message from the
+         *  simulator.
+         *
+         *  @return bool True if a message was received during the last tick.
+         */
+        bool IsUpdated() const
+        {
+            return updated_;
+        }
+
+        /**
+         *  Returns the latest information from the simulator. The snapshot is
+         *  shared rather than copied, and is decoded as it is read.
+         *
+         *  @return std::shared_ptr<const SimulatorSnapshot> The latest
+         *  information from the simulator, as of the last tick. Later ticks
+         *  do not modify it.
+         */
+        std::shared_ptr<const SimulatorSnapshot> GetLastUpdate() const
+        {
+            return view_->snapshot;
+        }
+
+        /**
+         *  Returns the true poses of the ball and robots, as of the last
+         *  tick.
+         *
+         *  @return const SceneGraph& The simulator's scene. Valid until the
+         *  next Tick().
+         */
+        const SceneGraph& GetScene() const
+        {
+            return view_->scene;
+        }
+
+        /**
+         *  How many simulator messages a batch waits for its acknowledgement
+         *  by default, before counting as applied anyway.
+         */
+        constexpr static int ACK_TIMEOUT_MESSAGES = 50;
+
+        /**
+         *  Returns a ticket for the commands queued so far.
+         *
+         *  @param timeout_messages How many simulator messages to wait for
+         *  the acknowledgement before counting the commands as applied
+         *  anyway. The longest timeout asked for applies to the batch.
+         *  @return uint64_t A ticket to pass to IsAcknowledged().
+         */
+        uint64_t GetTicket(const int timeout_messages = ACK_TIMEOUT_MESSAGES)
+        {
+            if (pending_.empty())
+            {
+                return last_batch_;
+            }
+            ack_timeout_ = std::max(ack_timeout_, timeout_messages);
+            return last_batch_ + 1;
+        }
+
+        /**
+         *  Indicates whether the simulator has applied the commands covered by
+         *  a ticket.
+         *
+         *  @param ticket A ticket returned by GetTicket().
+         *  @return bool True once the simulator has acknowledged the commands,
+         *  or has failed to within the ticket's timeout.
+         */
+        bool IsAcknowledged(const uint64_t ticket) const
+        {
+            return ticket <= view_->acked_batch;
+        }
+
+        /**
+         *  Sends every queued command to the simulator, concatenated into a
+         *  single message and followed by an acknowledgement request. Call 
+         *  once per tick, after the experiment has queued its commands.
+         *
+         *  @return bool True indicates success, or nothing was queued. When
+         *  the I/O thread is running, true indicates the batch was handed to
+         *  it; if its queue is full, the commands stay queued for the next 
+         *  flush. If a batch cannot be sent, the connection is closed and
+         *  the next Tick() returns false.
+         */
+        bool Flush()
+        {
+            if (pending_.empty())
+            {
+                return true;
+            }
+
+            // Every batch asks for an acknowledgement, so its commands can be
+            // tracked until the simulator has applied them
+            outgoing_.id = last_batch_ + 1;
+            outgoing_.timeout = ack_timeout_;
+            outgoing_.text.clear();
+            for (const auto& c : pending_)
+            {
+                outgoing_.text.append(c.text);
+            }
+            outgoing_.text.append("(getAck ");
+            outgoing_.text.append(std::to_string(outgoing_.id));
+            outgoing_.text.push_back(')');
+
+            if (running_)
+            {
+                if (!batches_.Push(outgoing_))
+                {
+                    return false;
+                }
+                Wake();
+            }
+            else if (!SendBatch(outgoing_))
+            {
+                return false;
+            }
+
+            ++last_batch_;
+            for (const auto& c : pending_)
+            {
+                if (!c.key.empty())
+                {
+                    last_sent_[c.key] = Sent{c.text, last_batch_};
+                }
+            }
+            pending_.clear();
+            ack_timeout_ = ACK_TIMEOUT_MESSAGES;
+            return true;
+        }
+
+        /**
+         *  Queues the init command.
+         *
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendInit()
+        {
+            return Queue("", "(init)");
+        }
+
+        /**
+         *  Queues the kick off command, which initiates a kick off for a 
+         *  specific team.
+         *
+         *  @param team 0 the 'left' team, 1 indicates the 'right' team.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendKickOffCommand(bool team)
+        {
+            return Queue("", team ? "(kickOffRight)" : "(kickOffLeft)");
+        }
+
+        /**
+         *  Queues the drop ball command.
+         *
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendDropBallCommand()
+        {
+            return Queue("", "(dropBall)");
+        }
+
+        /**
+         *  Queues the ball command, which places the ball and sets its 
+         *  velocity. Supersedes a queued ball command.
+         * 
+         *  @param x_pos The desired X position of the ball.
+         *  @param y_pos The desired Y position of the ball.
+         *  @param z_pos The desired Z position of the ball.
+         *  @param x_vel The desired X velocity of the ball.
+         *  @param y_vel The desired Y velocity of the ball.
+         *  @param z_vel The desired Z velocity of the ball.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendMoveBallCommand(float x_pos, float y_pos, float z_pos, 
+                                 float x_vel, float y_vel, float z_vel)
+        {
+            text_ = "(ball (pos ";
+            AppendValues({x_pos, y_pos, z_pos});
+            text_ += ") (vel ";
+            AppendValues({x_vel, y_vel, z_vel});
+            text_ += "))";
+            return Queue("ball", text_);
+        }
+
+        /**
+         *  Queues the ball command, which places the ball and stops it. 
+         *  Supersedes a queued ball command.
+         * 
+         *  @param x_pos The desired X position of the ball.
+         *  @param y_pos The desired Y position of the ball.
+         *  @param z_pos The desired Z position of the ball.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendMoveBallCommand(float x_pos, float y_pos, float z_pos)
+        {
+            return SendMoveBallCommand(x_pos, y_pos, z_pos, 0, 0, 0);
+        }
+
+        /**
+         *  Queues the play mode command, which changes the current play mode.
+         *  Supersedes a queued play mode command.
+         *
+         *  @param play_mode The new PlayMode to set.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendPlayModeCommand(PlayMode play_mode)
+        {
+            return Queue("playMode", "(playMode " + play_mode.ToString() + ")");
+        }
+
+        /**
+         *  Queues the move player command, which changes the field position of 
+         *  an agent. Supersedes a queued move of the same player.
+         *
+         *  @param to_move The agent to move.
+         *  @param x_pos The X position to move to.
+         *  @param y_pos The Y position to move to.
+         *  @param z_pos The Z position to move to.
+         *  @param orientation The orientation to face.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendMovePlayerCommand(const Player& to_move, float x_pos,
+                                   float y_pos, float z_pos, float orientation)
+        {
+            text_ = PlayerCommand("agent", to_move);
+            text_.pop_back();
+            text_ += "(move ";
+            AppendValues({x_pos, y_pos, z_pos, orientation});
+            text_ += "))";
+            return Queue("agent " + to_move.team + " " 
+                         + std::to_string(to_move.number), text_);
+        }
+
+        /**
+         *  Queues a free kick command, which awards a team a free kick.
+         *
+         *  @param team 0 the 'left' team, 1 indicates the 'right' team.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendFreeKickCommand(bool team)
+        {
+            return Queue("", team ? "(free_kick_right)" : "(free_kick_left)");
+        }
+
+        /**
+         *  Queues a direct free kick command, which awards a team a direct
+         *  free kick.
+         *
+         *  @param team 0 the 'left' team, 1 indicates the 'right' team.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendDirectFreeKickCommand(bool team)
+        {
+            return Queue("", team ? "(direct_free_kick_right)" 
+                                  : "(direct_free_kick_left)");
+        }
+
+        /**
+         *  Queues the kill server command, which kills the simulator.
+         *
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendKillServerCommand()
+        {
+            return Queue("", "(killsim)");
+        }
+
+        /**
+         *  Queues the time command, which changes the time of the game.
+         *  Supersedes a queued time command.
+         *
+         *  @param time The new game time.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendSetTimeCommand(int time)
+        {
+            return Queue("time", "(time " + std::to_string(time) + ")");
+        }
+
+        /**
+         *  Queues a command resetting the game time to 0.
+         *
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendResetTimeCommand()
+        {
+            return SendSetTimeCommand(0);
+        }
+
+        /**
+         *  Queues a full state request.
+         *
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendFullStateRequest()
+        {
+            return Queue("reqfullstate", "(reqfullstate)");
+        }
+
+        /**
+         *  Queues an acknowledgement request on its own. Every flushed batch
+         *  already ends with one, so this is only needed to wait, with
+         *  GetTicket() and IsAcknowledged(), for commands that were sent
+         *  earlier when nothing else is queued.
+         *
+         *  @return bool True indicates the request was queued.
+         */
+        bool SendGetAckCommand()
+        {
+            return Queue("getAck", "");
+        }
+
+        /**
+         *  Queues a set score command. Supersedes a queued set score command.
+         *
+         *  @param left_score The new score for the left team
+         *  @param right_score The new score for the right team
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendSetScoreCommand(int left_score, int right_score)
+        {
+            return Queue("score", "(score (left " + std::to_string(left_score) 
+                         + ") (right " + std::to_string(right_score) + "))");
+        }
+
+        /**
+         *  Queues a command disconnecting the specified player from the 
+         *  simulation.
+         *
+         *  @param to_kill The player to remove from the simulation.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendKillPlayerCommand(const Player& to_kill)
+        {
+            return Queue("", PlayerCommand("kill", to_kill));
+        }
+
+        /**
+         *  Queues a command repositioning the player to the side of the 
+         *  field, as the server does when a robot commits a foul.
+         *
+         *  @param to_repos The player to reposition.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendReposPlayerCommand(const Player& to_repos)
+        {
+            return Queue("", PlayerCommand("repos", to_repos));
+        }
+
+        /**
+         *  Queues a command selecting a player. Supersedes a queued select
+         *  command.
+         *
+         *  @param to_select The player to select.
+         *  @return bool True indicates the command was queued.
+         */
+        bool SendSelectPlayerCommand(const Player& to_select)
+        {
+            return Queue("select", PlayerCommand("select", to_select));
+        }
+
+    private:
+        /**
+         *  The longest time in milliseconds the I/O thread waits for socket
+         *  events before checking whether it should stop.
+         */
+        constexpr static int IO_WAIT_MS = 100;
+
+        /**
+         *  The maximum number of flushed batches that can be waiting for the
+         *  I/O thread.
+         */
+        constexpr static size_t MAX_BATCHES = 64;
+
+        /**
+         *  The epoll tokens for the simulator socket and the wake eventfd.
+         */
+        constexpr static uint64_t SOCKET_TOKEN = 0;
+        constexpr static uint64_t WAKE_TOKEN = 1;
+
+        /**
+         *  The state published by whichever thread performs simulator I/O.
+         */
+        struct State
+        {
+            /**< The latest information from the simulator */
+            std::shared_ptr<const SimulatorSnapshot> snapshot 
+                = std::make_shared<const SimulatorSnapshot>();
+            SceneGraph scene;           /**< The poses of the ball and robots */
+            uint64_t acked_batch = 0;   /**< The last batch acknowledged */
+            uint64_t received = 0;      /**< The number of messages received */
+            bool open = true;           /**< Indicates the simulator is connected */
+        };
+
+        /**
+         *  A flushed batch of commands.
+         */
+        struct Batch
+        {
+            uint64_t id;        /**< The batch's sequence number */
+            int timeout;        /**< Messages to wait for its acknowledgement */
+            std::string text;   /**< The concatenated commands */
+        };
+
+        /**
+         *  A command waiting to be sent.
+         */
+        struct Command
+        {
+            std::string key;    /**< Commands with the same key supersede each other, empty if none */
+            std::string text;   /**< The command */
+        };
+
+        /**
+         *  The start of the simulator's answer to "(getAck <id>)", which is
+         *  followed by the id.
+         */
+        constexpr static std::string_view ACK = "(ack ";
+
+        /**
+         *  The last command sent with a given key.
+         */
+        struct Sent
+        {
+            std::string text;   /**< The command */
+            uint64_t batch;     /**< The batch the command was sent in */
+        };
+
+        /**
+         *  A batch waiting for its acknowledgement.
+         */
+        struct InFlight
+        {
+            uint64_t batch;     /**< The batch */
+            int timeout;        /**< Messages to wait before assuming it was applied */
+            int waited;         /**< Messages received since it was sent */
+        };
+
+        /**
+         *  Queues a command. A queued command with the same key is dropped, 
+         *  unless a command without a key was queued after it, since that 
+         *  command may depend on it. The command itself is dropped if an
+         *  identical command has been sent and not yet acknowledged.
+         *
+         *  @param key The command's key, or empty if the command supersedes
+         *  nothing.
+         *  @param text The command.
+         *  @return bool Always true, for convenience.
+         */
+        bool Queue(const std::string& key, const std::string& text)
+        {
+            if (key.empty())
+            {
+                pending_.push_back(Command{key, text});
+                return true;
+            }
+
+            bool barrier = false;
+            bool queued = false;
+            for (size_t i = pending_.size(); i-- > 0; )
+            {
+                if (pending_[i].key == key)
+                {
+                    if (barrier)
+                    {
+                        queued = true;
+                    }
+                    else
+                    {
+                        pending_.erase(pending_.begin() + i);
+                    }
+                    break;
+                }
+                barrier = barrier || pending_[i].key.empty();
+            }
+
+            auto sent = last_sent_.find(key);
+            if (!queued && sent != last_sent_.end() && sent->second.text == text
+                && !IsAcknowledged(sent->second.batch))
+            {
+                return true;
+            }
+            pending_.push_back(Command{key, text});
+            return true;
+        }
+
+        /**
+         *  Creates the epoll instance and the wake eventfd, unless they 
+         *  already exist.
+         *
+         *  @return bool True indicates success.
+         */
+        bool InitEpoll()
+        {
+            if (epollfd_ > 0)
+            {
+                return true;
+            }
+
+            epollfd_ = epoll_create1(0);
+            wakefd_ = eventfd(0, EFD_NONBLOCK);
+            if (epollfd_ < 0 || wakefd_ < 0)
+            {
+                return false;
+            }
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = WAKE_TOKEN;
+            if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, wakefd_, &ev) < 0)
+            {
+                return false;
+            }
+            ev.data.u64 = SOCKET_TOKEN;
+            return epoll_ctl(epollfd_, EPOLL_CTL_ADD, sockfd_, &ev) == 0;
+        }
+
+        /**
+         *  The I/O thread's loop. Waits for the simulator or a flushed batch,
+         *  then handles both.
+         */
+        void Run()
+        {
+            struct epoll_event events[2];
+            while (running_)
+            {
+                int num_events = epoll_wait(epollfd_, events, 2, IO_WAIT_MS);
+                for (int i = 0; i < num_events; ++i)
+                {
+                    if (events[i].data.u64 == WAKE_TOKEN)
+                    {
+                        uint64_t count;
+                        read(wakefd_, &count, sizeof(count));
+                    }
+                }
+
+                bool was_open = open_;
+                HandleRequests();
+                Receive();
+
+                // A closed socket is always readable, so stop waiting on it
+                if (was_open && !open_)
+                {
+                    epoll_ctl(epollfd_, EPOLL_CTL_DEL, sockfd_, nullptr);
+                }
+            }
+        }
+
+        /**
+         *  Wakes the I/O thread.
+         */
+        void Wake()
+        {
+            uint64_t one = 1;
+            write(wakefd_, &one, sizeof(one));
+        }
+
+        /**
+         *  Sends the batches flushed for the I/O thread. Batches flushed after
+         *  the connection closed are dropped.
+         */
+        void HandleRequests()
+        {
+            while (batches_.Pop(&request_))
+            {
+                SendBatch(request_);
+            }
+        }
+
+        /**
+         *  Receives and decodes every available simulator message, then
+         *  publishes the resulting state.
+         */
+        void Receive()
+        {
+            if (!open_)
+            {
+                return;
+            }
+
+            frames_.clear();
+            open_ = in_.Receive(sockfd_, &frames_);
+            for (const auto& f : frames_)
+            {
+                snapshot_ = std::make_shared<const SimulatorSnapshot>(
+                    *snapshot_, f);
+                tokens_.Build(f);
+                scene_.Update(tokens_);
+                TrackAck(f);
+            }
+            received_ += frames_.size();
+
+            if (!frames_.empty() || !open_)
+            {
+                Publish();
+            }
+        }
+
+        /**
+         *  Publishes the latest state for Tick() to pick up.
+         */
+        void Publish()
+        {
+            State& s = published_.GetWriteBuffer();
+            s.snapshot = snapshot_;
+            s.scene.CopyPoses(scene_);
+            s.acked_batch = acked_batch_;
+            s.received = received_;
+            s.open = open_;
+            published_.Publish();
+
+            if (running_ && notifyfd_ >= 0)
+            {
+                uint64_t one = 1;
+                write(notifyfd_, &one, sizeof(one));
+            }
+        }
+
+        /**
+         *  Sends a batch to the simulator as one message, and starts waiting
+         *  for its acknowledgement. If the batch cannot be sent, part of it
+         *  may have been, so the connection is closed.
+         *
+         *  @param batch The batch to send.
+         *  @return bool True indicates success.
+         */
+        bool SendBatch(const Batch& batch)
+        {
+            if (!open_)
+            {
+                return false;
+            }
+
+            FrameBuffer::Encode(batch.text, &frame_);
+            size_t sent = 0;
+            while (sent < frame_.size())
+            {
+                ssize_t n = send(sockfd_, frame_.data() + sent, 
+                                 frame_.size() - sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    open_ = false;
+                    Publish();
+                    return false;
+                }
+                sent += n;
+            }
+            in_flight_.push_back(InFlight{batch.id, batch.timeout, 0});
+            return true;
+        }
+
+        /**
+         *  Matches the acknowledgements in a simulator message to the batches
+         *  waiting for them by id. Batches are applied in order, so an
+         *  acknowledgement also covers every earlier batch. A batch that has
+         *  waited out its timeout counts as applied, along with those before
+         *  it.
+         *
+         *  @param msg The message received from the simulator.
+         */
+        void TrackAck(const std::string& msg)
+        {
+            if (in_flight_.empty())
+            {
+                return;
+            }
+
+            uint64_t acked = 0;
+            const char* end = msg.data() + msg.size();
+            for (size_t pos = msg.find(ACK); pos != std::string::npos;
+                 pos = msg.find(ACK, pos + ACK.size()))
+            {
+                uint64_t id;
+                auto result = std::from_chars(msg.data() + pos + ACK.size(),
+                                              end, id);
+                if (result.ec == std::errc() && result.ptr != end 
+                    && *result.ptr == ')')
+                {
+                    acked = std::max(acked, id);
+                }
+            }
+
+            for (auto& b : in_flight_)
+            {
+                ++b.waited;
+                if (b.waited >= b.timeout)
+                {
+                    acked = std::max(acked, b.batch);
+                }
+            }
+
+            while (!in_flight_.empty() && in_flight_.front().batch <= acked)
+            {
+                acked_batch_ = in_flight_.front().batch;
+                in_flight_.pop_front();
+            }
+        }
+
+        /**
+         *  Formats a command addressing a player, for example
+         *  "(select (team Left)(unum 3))".
+         *
+         *  @param name The command's name.
+         *  @param player The player addressed.
+         *  @return std::string The command.
+         */
+        static std::string PlayerCommand(const char* name, const Player& player)
+        {
+            return std::string("(") + name + " (team " + player.team 
+                + ")(unum " + std::to_string(player.number) + "))";
+        }
+
+        /**
+         *  Appends space separated values to text_, with two decimal places.
+         *
+         *  @param values The values to append.
+         */
+        void AppendValues(std::initializer_list<float> values)
+        {
+            char buffer[32];
+            bool first = true;
+            for (float v : values)
+            {
+                if (!first)
+                {
+                    text_ += ' ';
+                }
+                first = false;
+                auto result = std::to_chars(buffer, buffer + sizeof(buffer), v,
+                                            std::chars_format::fixed, 2);
+                text_.append(buffer, result.ptr);
+            }
+        }
+
+        int sockfd_;                        /**< The socket connected to the simulator */
+        int epollfd_;                       /**< Waits for the socket and wake events */
+        int wakefd_;                        /**< Wakes the I/O thread when batches are flushed */
+        int notifyfd_;                      /**< Signalled when the I/O thread publishes */
+        FrameBuffer in_;                    /**< Reassembles simulator messages */
+        std::vector<std::string> frames_;   /**< Holds messages between receiving and parsing */
+        std::shared_ptr<const SimulatorSnapshot> snapshot_; /**< The latest information from the simulator */
+        SExpressionIndex tokens_;           /**< Tokenises messages for the scene graph */
+        SceneGraph scene_;                  /**< The true poses of the ball and robots */
+        std::string frame_;                 /**< Holds the framed batch while it is sent */
+        Batch request_;                     /**< Holds a batch popped from the queue */
+        std::deque<InFlight> in_flight_;    /**< Batches waiting for acknowledgement, oldest first */
+        uint64_t acked_batch_;              /**< The last batch acknowledged */
+        uint64_t received_;                 /**< The number of messages received */
+        bool open_;                         /**< Indicates the simulator is connected */
+
+        TripleBuffer<State> published_;     /**< Hands the latest state to Tick() */
+        SpscQueue<Batch, MAX_BATCHES> batches_; /**< Flushed batches waiting for the I/O thread */
+        std::thread io_thread_;             /**< Performs simulator I/O after Start() */
+
+        const State* view_;                 /**< The state picked up by the last tick */
+        std::vector<Command> pending_;      /**< Commands queued since the last flush */
+        std::string text_;                  /**< Holds a command while it is formatted */
+        Batch outgoing_;                    /**< Holds queued commands while they are flushed */
+        std::unordered_map<std::string, Sent> last_sent_; /**< The last command sent per key */
+        uint64_t last_batch_;               /**< The last batch flushed */
+        int ack_timeout_;                   /**< Messages the next batch waits for its acknowledgement */
+        uint64_t last_received_;            /**< The message count as of the last tick */
+        bool updated_;                      /**< Indicates the last tick received a message */
+        std::atomic<bool> running_;         /**< Indicates the I/O thread is running */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_ASYNCSIMULATORCONNECTION_H_
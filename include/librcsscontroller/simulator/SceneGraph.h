@@ -0,0 +1,451 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_SCENEGRAPH_H_
+#define LIBRCSSCONTROLLER_SCENEGRAPH_H_
+
+#include "comms/SExpressionIndex.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace librcsscontroller 
+{
+    /**
+     *  The SceneGraph class tracks the true poses of the ball and robots from
+     *  the scene graph that rcssserver3d sends to monitors.
+     *
+     *  A full scene (RSG) rebuilds a table of every node's local transform and
+     *  finds the ball mesh and the robot meshes (those carrying matNum
+     *  materials). Scene deltas (RDS) have the same shape as the last full
+     *  scene, so their transforms are written into the table in place. The
+     *  world poses of the ball and robots are recomputed after every message,
+     *  without any extra queries to the simulator.
+     */
+    class SceneGraph
+    {
+    public:
+        /**
+         *  A pose in field coordinates.
+         */
+        struct Pose
+        {
+            float x;            /**< Metres along the field's length */
+            float y;            /**< Metres along the field's width */
+            float z;            /**< Metres above the field */
+            float orientation;  /**< Radians; the heading of the model's x-axis */
+        };
+
+        /**
+         *  A robot on the field.
+         */
+        struct Robot
+        {
+            int number;         /**< Player number */
+            std::string team;   /**< "Left" or "Right" */
+            Pose pose;          /**< The pose of the robot's body */
+        };
+
+        /**
+         *  Constructor
+         */
+        SceneGraph()
+            : tokens_{nullptr}, ball_node_{-1}, ball_{0, 0, 0, 0}, next_node_{0}, 
+              full_{false}, consistent_{false}
+        { }
+
+        /**
+         *  Updates the table from a monitor message. Messages without a scene
+         *  graph leave the table unchanged.
+         *
+         *  @param tokens The tokens of the message received from the 
+         *  simulator, built once and shared with any other reader.
+         *  @return bool True indicates success. False indicates a delta did not
+         *  match the last full scene; poses are then stale until the next full
+         *  scene.
+         */
+        bool Update(const SExpressionIndex& tokens)
+        {
+            tokens_ = &tokens;
+
+            // Skip the environment, then find the scene header and its body
+            size_t i = 0;
+            if (!Skip(&i))
+            {
+                return true;
+            }
+            while (i + 1 < tokens_->Size() && tokens_->IsOpen(i))
+            {
+                std::string_view kind = tokens_->Text(i + 1);
+                if (kind == "RSG" || kind == "RDS")
+                {
+                    full_ = kind == "RSG";
+                    Skip(&i);
+                    return i < tokens_->Size() && ParseScene(i);
+                }
+                Skip(&i);
+            }
+            return true;
+        }
+
+        /**
+         *  Returns the pose of the ball.
+         *
+         *  @param out[out] The location to save the pose to.
+         *  @return bool True if the ball is in the scene.
+         */
+        bool GetBallPose(Pose* out) const
+        {
+            if (ball_node_ < 0)
+            {
+                return false;
+            }
+            *out = ball_;
+            return true;
+        }
+
+        /**
+         *  Returns the robots in the scene.
+         *
+         *  @return const std::vector<Robot>& The robots in the scene. Valid
+         *  until the next Update().
+         */
+        const std::vector<Robot>& GetRobots() const
+        {
+            return robots_;
+        }
+
+        /**
+         *  Finds a robot by player number and team.
+         *
+         *  @param number The player number.
+         *  @param team The team, "Left" or "Right".
+         *  @return const Robot* The robot, or nullptr. Valid until the next
+         *  Update().
+         */
+        const Robot* FindRobot(const int number, std::string_view team) const
+        {
+            for (const auto& r : robots_)
+            {
+                if (r.number == number && r.team == team)
+                {
+                    return &r;
+                }
+            }
+            return nullptr;
+        }
+
+        /**
+         *  Indicates whether the table matches the simulator's scene.
+         *
+         *  @return bool True if a full scene has been received, and every
+         *  delta since has matched it.
+         */
+        bool IsConsistent() const
+        {
+            return consistent_;
+        }
+
+        /**
+         *  Copies the poses of another scene, but not its node table. The
+         *  copy answers queries like the original, but cannot be updated.
+         *  Used to hand poses to another thread without copying every node.
+         *
+         *  @param other The scene to copy the poses of.
+         */
+        void CopyPoses(const SceneGraph& other)
+        {
+            ball_node_ = other.ball_node_;
+            ball_ = other.ball_;
+            robots_ = other.robots_;
+            consistent_ = other.consistent_;
+        }
+
+    private:
+        /**
+         *  A node of the scene graph.
+         */
+        struct Node
+        {
+            int parent;             /**< The parent node, or -1 */
+            float transform[16];    /**< Local transform, column-major */
+        };
+
+        /**
+         *  Parses the list of top-level nodes.
+         *
+         *  @param i The index of the list's opening '('.
+         *  @return bool True indicates success.
+         */
+        bool ParseScene(size_t i)
+        {
+            if (full_)
+            {
+                nodes_.clear();
+                ball_node_ = -1;
+                robot_nodes_.clear();
+                robots_.clear();
+                consistent_ = true;
+            }
+            else if (!consistent_)
+            {
+                return false;
+            }
+            next_node_ = 0;
+
+            bool ok = tokens_->IsOpen(i++) && ParseChildren(&i, -1)
+                && next_node_ == nodes_.size();
+            consistent_ = consistent_ && ok;
+
+            Refresh();
+            return ok;
+        }
+
+        /**
+         *  Parses the contents of a node or of the top-level list, up to and
+         *  including its closing ')'.
+         *
+         *  @param i[in,out] The index of the first token of the contents.
+         *  @param node The node being parsed, or -1 for the top-level list.
+         *  @return bool True indicates success.
+         */
+        bool ParseChildren(size_t* i, const int node)
+        {
+            bool is_ball = false;
+            int number = -1;
+            std::string_view team;
+
+            while (*i < tokens_->Size() && !tokens_->IsClose(*i))
+            {
+                if (tokens_->IsAtom(*i) || *i + 1 >= tokens_->Size())
+                {
+                    ++*i;
+                    continue;
+                }
+
+                std::string_view key = tokens_->Text(*i + 1);
+                if (key == "nd")
+                {
+                    if (!ParseNode(i, node))
+                    {
+                        return false;
+                    }
+                    continue;
+                }
+
+                if (node >= 0 && key == "SLT")
+                {
+                    ReadTransform(*i + 2, nodes_[node].transform);
+                }
+                else if (full_ && key == "load")
+                {
+                    is_ball = *i + 2 < tokens_->Size() 
+                        && tokens_->Text(*i + 2).find("soccerball") != std::string_view::npos;
+                }
+                else if (full_ && key == "resetMaterials")
+                {
+                    ReadMaterials(*i + 2, &number, &team);
+                }
+                Skip(i);
+            }
+
+            if (node >= 0 && is_ball)
+            {
+                ball_node_ = node;
+            }
+            if (node >= 0 && number >= 0)
+            {
+                robot_nodes_.push_back(node);
+                robots_.push_back(Robot{number, std::string(team), Pose{0, 0, 0, 0}});
+            }
+
+            ++*i;
+            return true;
+        }
+
+        /**
+         *  Parses a node, adding it to the table for full scenes and matching
+         *  it to the table for deltas.
+         *
+         *  @param i[in,out] The index of the node's opening '('.
+         *  @param parent The parent node, or -1.
+         *  @return bool True indicates success.
+         */
+        bool ParseNode(size_t* i, const int parent)
+        {
+            int node = static_cast<int>(next_node_++);
+            if (full_)
+            {
+                nodes_.push_back(Node{parent, {1, 0, 0, 0, 0, 1, 0, 0, 
+                                               0, 0, 1, 0, 0, 0, 0, 1}});
+            }
+            else if (node >= static_cast<int>(nodes_.size()) 
+                     || nodes_[node].parent != parent)
+            {
+                return false;
+            }
+
+            *i += 2;
+            return ParseChildren(i, node);
+        }
+
+        /**
+         *  Reads a transform's 16 values.
+         *
+         *  @param i The index of the first value.
+         *  @param out[out] The transform to write to. Left unchanged if the
+         *  values cannot be read.
+         */
+        void ReadTransform(const size_t i, float* out)
+        {
+            float m[16];
+            for (size_t k = 0; k < 16; ++k)
+            {
+                if (i + k >= tokens_->Size() || !tokens_->IsAtom(i + k))
+                {
+                    return;
+                }
+                std::string_view v = tokens_->Text(i + k);
+                if (std::from_chars(v.data(), v.data() + v.size(), m[k]).ec 
+                    != std::errc())
+                {
+                    return;
+                }
+            }
+            std::copy(m, m + 16, out);
+        }
+
+        /**
+         *  Reads a robot's number and team from its materials, for example
+         *  "matNum3 matLeft".
+         *
+         *  @param i The index of the first material.
+         *  @param number[out] The player number, if found.
+         *  @param team[out] The team, if found.
+         */
+        void ReadMaterials(size_t i, int* number, std::string_view* team)
+        {
+            const std::string_view MAT_NUM = "matNum";
+
+            for (; i + 1 < tokens_->Size() && tokens_->IsAtom(i); ++i)
+            {
+                std::string_view word = tokens_->Text(i);
+                if (word.size() > MAT_NUM.size() && word.substr(0, MAT_NUM.size()) == MAT_NUM)
+                {
+                    std::from_chars(word.data() + MAT_NUM.size(), 
+                                    word.data() + word.size(), *number);
+                    *team = tokens_->Text(i + 1) == "matLeft" ? "Left" : "Right";
+                    return;
+                }
+            }
+        }
+
+        /**
+         *  Advances past the expression starting at a '(' (or past a single
+         *  token otherwise).
+         *
+         *  @param i[in,out] The index of the expression.
+         *  @return bool True if the expression was complete.
+         */
+        bool Skip(size_t* i) const
+        {
+            int depth = 0;
+            do
+            {
+                if (*i >= tokens_->Size())
+                {
+                    return false;
+                }
+                if (tokens_->IsOpen(*i))
+                {
+                    ++depth;
+                }
+                else if (tokens_->IsClose(*i))
+                {
+                    --depth;
+                }
+                ++*i;
+            } while (depth > 0);
+            return true;
+        }
+
+        /**
+         *  Recomputes the world poses of the ball and robots.
+         */
+        void Refresh()
+        {
+            if (ball_node_ >= 0)
+            {
+                ball_ = WorldPose(ball_node_);
+            }
+            for (size_t k = 0; k < robots_.size(); ++k)
+            {
+                robots_[k].pose = WorldPose(robot_nodes_[k]);
+            }
+        }
+
+        /**
+         *  Computes the world pose of a node, by composing the transforms of
+         *  the node and its ancestors.
+         *
+         *  @param node The node.
+         *  @return Pose The node's world pose.
+         */
+        Pose WorldPose(int node) const
+        {
+            float world[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+            for (; node >= 0; node = nodes_[node].parent)
+            {
+                // world = parent * world
+                const float* p = nodes_[node].transform;
+                float result[16];
+                for (int c = 0; c < 4; ++c)
+                {
+                    for (int r = 0; r < 4; ++r)
+                    {
+                        result[c * 4 + r] = p[r] * world[c * 4] 
+                            + p[4 + r] * world[c * 4 + 1]
+                            + p[8 + r] * world[c * 4 + 2] 
+                            + p[12 + r] * world[c * 4 + 3];
+                    }
+                }
+                std::copy(result, result + 16, world);
+            }
+            return Pose{world[12], world[13], world[14], 
+                        std::atan2(world[1], world[0])};
+        }
+
+        const SExpressionIndex* tokens_; /**< The tokens of the message being parsed */
+        std::vector<Node> nodes_;       /**< Every node of the last full scene, in order */
+        int ball_node_;                 /**< The node of the ball mesh, or -1 */
+        std::vector<int> robot_nodes_;  /**< The node of each robot's mesh */
+        Pose ball_;                     /**< The pose of the ball */
+        std::vector<Robot> robots_;     /**< The robots, in scene order */
+        size_t next_node_;              /**< The next node to be parsed */
+        bool full_;                     /**< Indicates the scene being parsed is full */
+        bool consistent_;               /**< Indicates the table matches the simulator */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_SCENEGRAPH_H_
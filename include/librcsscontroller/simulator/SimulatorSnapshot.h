@@ -0,0 +1,418 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_SIMULATORSNAPSHOT_H_
+#define LIBRCSSCONTROLLER_SIMULATORSNAPSHOT_H_
+
+#include "comms/StringViewParser.h"
+#include "Player.h"
+#include "PlayMode.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace librcsscontroller 
+{
+    /**
+     *  The SimulatorSnapshot class holds the state of the simulator after a
+     *  message, as an immutable value that is shared rather than copied.
+     *
+     *  Messages are split into two sections: the environment (the first
+     *  expression, holding the simulator time and play mode) and the scene
+     *  graph (the rest, holding the players). Sections identical to the
+     *  previous message's, or that carry nothing the snapshot decodes, are
+     *  shared with the previous snapshot instead of being stored again.
+     *
+     *  Stored sections are decoded on first access, so checking the play mode
+     *  never touches the scene graph. Each section is decoded exactly once,
+     *  under std::call_once, so a snapshot may be read by any number of 
+     *  threads.
+     */
+    class SimulatorSnapshot
+    {
+    public:
+        /**
+         *  Constructor. Creates the snapshot before any message is received.
+         */
+        SimulatorSnapshot()
+            : environment_{std::make_shared<Environment>(std::string_view(), 0)},
+              scene_{std::make_shared<Scene>()},
+              time_{0}
+        { }
+
+        /**
+         *  Constructor. Creates the snapshot following a message.
+         *
+         *  @param previous The snapshot before the message.
+         *  @param msg The message received from the simulator.
+         */
+        SimulatorSnapshot(const SimulatorSnapshot& previous, std::string_view msg)
+            : environment_{previous.environment_}, scene_{previous.scene_},
+              time_{previous.time_}
+        {
+            size_t split = EnvironmentLength(msg);
+            std::string_view environment = msg.substr(0, split);
+            std::string_view scene = msg.substr(split);
+
+            ReadTime(environment, &time_);
+
+            // Only hash sections holding what is decoded from them
+            if (Contains(environment, PLAY_MODE))
+            {
+                uint64_t hash = Hash(environment);
+                if (hash != environment_->hash)
+                {
+                    environment_ = std::make_shared<Environment>(environment, hash);
+                }
+            }
+
+            if (Contains(scene, MAT_NUM))
+            {
+                uint64_t hash = Hash(scene);
+                if (hash != scene_->hash)
+                {
+                    scene_ = std::make_shared<Scene>(scene, hash, scene_);
+                }
+            }
+        }
+
+        /**
+         *  Returns the current play mode.
+         *
+         *  @return PlayMode The current play mode.
+         */
+        PlayMode GetPlayMode() const
+        {
+            return environment_->GetPlayMode();
+        }
+
+        /**
+         *  Returns the simulator time, which only advances as the simulation
+         *  is stepped.
+         *
+         *  @return double The simulator time in seconds, as of the last
+         *  message that reported it. 0 if none has.
+         */
+        double GetTime() const
+        {
+            return time_;
+        }
+
+        /**
+         *  Returns the players present on the simulator.
+         *
+         *  @return const std::vector<Player>& The players present on the
+         *  simulator. Valid for the lifetime of the snapshot.
+         */
+        const std::vector<Player>& GetPlayers() const
+        {
+            return scene_->GetPlayers();
+        }
+
+    private:
+        /**
+         *  The key of the play mode in the environment section.
+         */
+        constexpr static std::string_view PLAY_MODE = "play_mode";
+
+        /**
+         *  The start of the simulator time in the environment section.
+         */
+        constexpr static std::string_view TIME = "(time ";
+
+        /**
+         *  The material prefix naming a player's number in the scene graph.
+         */
+        constexpr static std::string_view MAT_NUM = "matNum";
+
+        /**
+         *  The most scene sections left undecoded in a chain. Past this, a 
+         *  new section is decoded when it is stored, so the text of unread 
+         *  snapshots cannot accumulate without bound.
+         */
+        constexpr static size_t MAX_PENDING = 16;
+
+        /**
+         *  The environment section of a message.
+         */
+        class Environment
+        {
+        public:
+            /**
+             *  Constructor
+             *
+             *  @param text The environment section.
+             *  @param hash The hash of the section.
+             */
+            Environment(std::string_view text, const uint64_t hash)
+                : hash{hash}, text_{text}, play_mode_{PlayMode::BEFORE_KICK_OFF}
+            { }
+
+            /**
+             *  Returns the play mode, decoding it on first call.
+             *
+             *  @return PlayMode The play mode.
+             */
+            PlayMode GetPlayMode() const
+            {
+                std::call_once(decoded_, [this] { Decode(); });
+                return play_mode_;
+            }
+
+            const uint64_t hash;                /**< The hash of the section */
+
+        private:
+            /**
+             *  Decodes the play mode and releases the text.
+             */
+            void Decode() const
+            {
+                StringViewParser msg(text_);
+                std::string_view word;
+                while (msg.ReadDelimitedWord(&word))
+                {
+                    if (word == PLAY_MODE)
+                    {
+                        int mode;
+                        if (msg.ReadType(&mode))
+                        {
+                            play_mode_ = PlayMode(mode);
+                        }
+                        break;
+                    }
+                }
+                std::string().swap(text_);
+            }
+
+            mutable std::string text_;          /**< The section, until decoded */
+            mutable std::once_flag decoded_;    /**< Guards decoding */
+            mutable PlayMode play_mode_;        /**< The decoded play mode */
+        };
+
+        /**
+         *  The scene graph section of a message. Players accumulate over
+         *  messages, so each section chains to the previous one until it is 
+         *  decoded.
+         */
+        class Scene
+        {
+        public:
+            /**
+             *  Constructor. Creates the section before any message is
+             *  received.
+             */
+            Scene()
+                : hash{0}, pending_{0}
+            { 
+                std::call_once(decoded_, [] { });
+            }
+
+            /**
+             *  Constructor
+             *
+             *  @param text The scene graph section.
+             *  @param hash The hash of the section.
+             *  @param previous The previous section holding players.
+             */
+            Scene(std::string_view text, const uint64_t hash, 
+                  std::shared_ptr<const Scene> previous)
+                : hash{hash}, pending_{previous->pending_ + 1}, text_{text}, 
+                  previous_{std::move(previous)}
+            { 
+                if (pending_ > MAX_PENDING)
+                {
+                    GetPlayers();
+                    pending_ = 0;
+                }
+            }
+
+            /**
+             *  Returns the players present, decoding them on first call.
+             *
+             *  @return const std::vector<Player>& The players present.
+             */
+            const std::vector<Player>& GetPlayers() const
+            {
+                std::call_once(decoded_, [this] { Decode(); });
+                return players_;
+            }
+
+            const uint64_t hash;                /**< The hash of the section */
+
+        private:
+            /**
+             *  Decodes the players named by matNum materials, for example
+             *  "matNum3 matLeft", adding them to those of the previous 
+             *  section. Releases the text and the previous section.
+             */
+            void Decode() const
+            {
+                players_ = previous_->GetPlayers();
+                std::string_view text = text_;
+                const void* found;
+                while ((found = memmem(text.data(), text.size(), 
+                                       MAT_NUM.data(), MAT_NUM.size())) != nullptr)
+                {
+                    text.remove_prefix(static_cast<const char*>(found) 
+                                       - text.data() + MAT_NUM.size());
+                    if (text.empty() || text[0] < '0' || text[0] > '9')
+                    {
+                        continue;
+                    }
+
+                    // The team is the next material in the same list
+                    StringViewParser msg(text);
+                    std::string_view number, material;
+                    if (!msg.ReadType(&number) || !msg.ReadType(&material))
+                    {
+                        continue;
+                    }
+                    Player player;
+                    player.number = number[0] - '0';
+                    player.team = material == "matLeft" ? "Left" : "Right";
+                    AddPlayer(player);
+                }
+                std::string().swap(text_);
+                previous_.reset();
+            }
+
+            /**
+             *  Adds a player unless it is already present.
+             *
+             *  @param player The player to add.
+             */
+            void AddPlayer(const Player& player) const
+            {
+                for (const auto& p : players_)
+                {
+                    if (p.number == player.number && p.team == player.team)
+                    {
+                        return;
+                    }
+                }
+                players_.push_back(player);
+            }
+
+            size_t pending_;                    /**< At most this many sections in the chain are undecoded */
+            mutable std::string text_;          /**< The section, until decoded */
+            mutable std::shared_ptr<const Scene> previous_; /**< The previous section, until decoded */
+            mutable std::once_flag decoded_;    /**< Guards decoding */
+            mutable std::vector<Player> players_; /**< The decoded players */
+        };
+
+        /**
+         *  Finds the end of the environment section: the first complete
+         *  expression of a message.
+         *
+         *  @param msg The message.
+         *  @return size_t The length of the environment section.
+         */
+        static size_t EnvironmentLength(std::string_view msg)
+        {
+            int depth = 0;
+            for (size_t i = 0; i < msg.size(); ++i)
+            {
+                if (msg[i] == '(')
+                {
+                    ++depth;
+                }
+                else if (msg[i] == ')' && --depth <= 0)
+                {
+                    return i + 1;
+                }
+            }
+            return msg.size();
+        }
+
+        /**
+         *  Reads the simulator time from an environment section.
+         *
+         *  @param environment The environment section.
+         *  @param out[out] The location to save the time to. Unchanged if the
+         *  section does not report the time.
+         */
+        static void ReadTime(std::string_view environment, double* out)
+        {
+            const void* found = memmem(environment.data(), environment.size(),
+                                       TIME.data(), TIME.size());
+            if (found == nullptr)
+            {
+                return;
+            }
+            size_t start = static_cast<const char*>(found) - environment.data()
+                + TIME.size();
+            StringViewParser msg(environment.substr(start));
+            double time;
+            if (msg.ReadType(&time))
+            {
+                *out = time;
+            }
+        }
+
+        /**
+         *  Indicates whether a section contains a string.
+         *
+         *  @param text The section to search.
+         *  @param needle The string to search for.
+         *  @return bool True if the string was found.
+         */
+        static bool Contains(std::string_view text, std::string_view needle)
+        {
+            return memmem(text.data(), text.size(),
+                          needle.data(), needle.size()) != nullptr;
+        }
+
+        /**
+         *  Hashes a section. FNV-1a, applied to 8 bytes at a time.
+         *
+         *  @param text The section to hash.
+         *  @return uint64_t The hash of the section.
+         */
+        static uint64_t Hash(std::string_view text)
+        {
+            const uint64_t PRIME = 1099511628211ull;
+
+            uint64_t hash = 14695981039346656037ull ^ text.size();
+            size_t i = 0;
+            for (; i + sizeof(uint64_t) <= text.size(); i += sizeof(uint64_t))
+            {
+                uint64_t word;
+                std::memcpy(&word, text.data() + i, sizeof(word));
+                hash = (hash ^ word) * PRIME;
+            }
+            for (; i < text.size(); ++i)
+            {
+                hash = (hash ^ static_cast<uint8_t>(text[i])) * PRIME;
+            }
+            return hash ^ (hash >> 32);
+        }
+
+        std::shared_ptr<const Environment> environment_;    /**< The section holding the play mode */
+        std::shared_ptr<const Scene> scene_;                /**< The latest section holding players */
+        double time_;                                       /**< The simulator time in seconds */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_SIMULATORSNAPSHOT_H_
@@ -0,0 +1,203 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_EVENTLOOP_H_
+#define LIBRCSSCONTROLLER_EVENTLOOP_H_
+
+#include <cerrno>
+#include <initializer_list>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace librcsscontroller
+{
+    /**
+     *  The EventLoop class blocks a controller's main thread until it has 
+     *  something to do, instead of polling in a busy loop.
+     *
+     *  The loop wakes when a watched file descriptor becomes readable, when
+     *  another thread signals the notify eventfd (as AgentServer and
+     *  AsyncSimulatorConnection do after publishing new state from their I/O
+     *  threads), or when the action scheduled with Schedule() is due.
+     */
+    class EventLoop
+    {
+    public:
+        /**
+         *  Constructor
+         */
+        EventLoop()
+            : epollfd_{-1}, notifyfd_{-1}, timerfd_{-1}
+        { }
+
+        /**
+         *  Destructor. Closes the loop's file descriptors.
+         */
+        ~EventLoop()
+        {
+            for (int fd : {epollfd_, notifyfd_, timerfd_})
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+        }
+
+        /**
+         *  Initialises the EventLoop.
+         *
+         *  @return bool True indicates success.
+         */
+        bool Init()
+        {
+            epollfd_ = epoll_create1(0);
+            notifyfd_ = eventfd(0, EFD_NONBLOCK);
+            timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+            if (epollfd_ < 0 || notifyfd_ < 0 || timerfd_ < 0)
+            {
+                return false;
+            }
+            return Add(notifyfd_, NOTIFY_TOKEN) && Add(timerfd_, TIMER_TOKEN);
+        }
+
+        /**
+         *  Wakes the loop whenever a file descriptor is readable. Whoever
+         *  owns the descriptor must read it after the loop wakes, or the loop
+         *  will not block again.
+         *
+         *  @param fd The file descriptor to watch.
+         *  @return bool True indicates success.
+         */
+        bool Watch(const int fd)
+        {
+            return Add(fd, WATCH_TOKEN);
+        }
+
+        /**
+         *  Stops watching a file descriptor. Must be called before the
+         *  descriptor is closed if another process may still hold a copy.
+         *
+         *  @param fd The file descriptor to stop watching.
+         *  @return bool True indicates success.
+         */
+        bool Unwatch(const int fd)
+        {
+            return epoll_ctl(epollfd_, EPOLL_CTL_DEL, fd, nullptr) == 0;
+        }
+
+        /**
+         *  Returns the eventfd other threads write to in order to wake the
+         *  loop.
+         *
+         *  @return int The notify eventfd.
+         */
+        int GetNotifyFd() const
+        {
+            return notifyfd_;
+        }
+
+        /**
+         *  Schedules the loop to wake after a delay, replacing any action
+         *  already scheduled.
+         *
+         *  @param delay_ms The delay in milliseconds. 0 cancels the scheduled
+         *  action.
+         *  @return bool True indicates success.
+         */
+        bool Schedule(const int delay_ms)
+        {
+            struct itimerspec spec = {};
+            spec.it_value.tv_sec = delay_ms / 1000;
+            spec.it_value.tv_nsec = (delay_ms % 1000) * 1000000L;
+            return timerfd_settime(timerfd_, 0, &spec, nullptr) == 0;
+        }
+
+        /**
+         *  Blocks until a watched descriptor is readable, the loop is
+         *  notified or the scheduled action is due.
+         *
+         *  @param timeout_ms The longest time to wait in milliseconds, or -1
+         *  to wait indefinitely.
+         *  @return bool True if the scheduled action is due. False otherwise.
+         */
+        bool Wait(const int timeout_ms = -1)
+        {
+            struct epoll_event events[MAX_EVENTS];
+            int num_events;
+            do
+            {
+                num_events = epoll_wait(epollfd_, events, MAX_EVENTS, 
+                                        timeout_ms);
+            } while (num_events < 0 && errno == EINTR);
+
+            bool due = false;
+            uint64_t count;
+            for (int i = 0; i < num_events; ++i)
+            {
+                if (events[i].data.u64 == NOTIFY_TOKEN)
+                {
+                    read(notifyfd_, &count, sizeof(count));
+                }
+                else if (events[i].data.u64 == TIMER_TOKEN)
+                {
+                    due = read(timerfd_, &count, sizeof(count)) > 0;
+                }
+            }
+            return due;
+        }
+
+    private:
+        /**
+         *  The maximum number of events handled per wait.
+         */
+        constexpr static int MAX_EVENTS = 16;
+
+        /**
+         *  The epoll tokens for each kind of descriptor.
+         */
+        constexpr static uint64_t WATCH_TOKEN = 0;
+        constexpr static uint64_t NOTIFY_TOKEN = 1;
+        constexpr static uint64_t TIMER_TOKEN = 2;
+
+        /**
+         *  Adds a descriptor to the epoll instance.
+         *
+         *  @param fd The file descriptor to add.
+         *  @param token The token to report its events with.
+         *  @return bool True indicates success.
+         */
+        bool Add(const int fd, const uint64_t token)
+        {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = token;
+            return epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+        }
+
+        int epollfd_;           /**< Waits for every event source */
+        int notifyfd_;          /**< Written by other threads to wake the loop */
+        int timerfd_;           /**< Expires when the scheduled action is due */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_EVENTLOOP_H_
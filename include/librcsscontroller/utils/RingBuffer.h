@@ -0,0 +1,86 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_RINGBUFFER_H_
+#define LIBRCSSCONTROLLER_RINGBUFFER_H_
+
+#include <array>
+#include <cstddef>
+
+namespace librcsscontroller
+{
+    /**
+     *  The RingBuffer class holds the last N values pushed to it. Storage is
+     *  fixed when the buffer is created, so pushing never allocates; once
+     *  the buffer is full, each push overwrites the oldest value.
+     *
+     *  @tparam T The type of value held by the buffer.
+     *  @tparam N The maximum number of values the buffer can hold. May be 0,
+     *  in which case nothing is ever held.
+     */
+    template <typename T, size_t N>
+    class RingBuffer
+    {
+    public:
+        /**
+         *  Constructor
+         */
+        RingBuffer();
+
+        /**
+         *  Makes room for a new value at the back of the buffer, dropping the
+         *  oldest value if the buffer is full. The previous contents of the
+         *  returned slot are left in place so their storage can be reused.
+         *  Must not be called when N is 0.
+         *
+         *  @return T& The slot to write the new value to.
+         */
+        T& Push();
+
+        /**
+         *  Removes all values from the buffer. Storage is kept for reuse.
+         */
+        void Clear();
+
+        /**
+         *  Returns the number of values held.
+         *
+         *  @return size_t The number of values held.
+         */
+        size_t Size() const;
+
+        /**
+         *  Returns a held value.
+         *
+         *  @param i The index of the value, where 0 is the oldest and 
+         *  Size() - 1 is the newest.
+         *  @return const T& The value.
+         */
+        const T& operator[](const size_t i) const;
+
+    private:
+        std::array<T, N> items_;    /**< Holds the values */
+        size_t start_;              /**< The index of the oldest value */
+        size_t size_;               /**< The number of values held */
+    };
+}
+
+#include "RingBuffer.tcc"
+
+#endif // LIBRCSSCONTROLLER_RINGBUFFER_H_
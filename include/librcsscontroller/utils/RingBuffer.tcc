@@ -0,0 +1,57 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace librcsscontroller
+{
+    template <typename T, size_t N>
+    RingBuffer<T, N>::RingBuffer()
+        : start_{0}, size_{0}
+    { }
+
+    template <typename T, size_t N>
+    T& RingBuffer<T, N>::Push()
+    {
+        if (size_ < N)
+        {
+            return items_[(start_ + size_++) % N];
+        }
+        T& oldest = items_[start_];
+        start_ = (start_ + 1) % N;
+        return oldest;
+    }
+
+    template <typename T, size_t N>
+    void RingBuffer<T, N>::Clear()
+    {
+        start_ = 0;
+        size_ = 0;
+    }
+
+    template <typename T, size_t N>
+    size_t RingBuffer<T, N>::Size() const
+    {
+        return size_;
+    }
+
+    template <typename T, size_t N>
+    const T& RingBuffer<T, N>::operator[](const size_t i) const
+    {
+        return items_[(start_ + i) % N];
+    }
+}
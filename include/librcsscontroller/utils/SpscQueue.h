@@ -0,0 +1,79 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_SPSCQUEUE_H_
+#define LIBRCSSCONTROLLER_SPSCQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace librcsscontroller
+{
+    /**
+     *  The SpscQueue class is a bounded first-in first-out queue that passes
+     *  values from one producer thread to one consumer thread without locks.
+     *
+     *  @tparam T The type of value held by the queue.
+     *  @tparam N The maximum number of values the queue can hold.
+     */
+    template <typename T, size_t N>
+    class SpscQueue
+    {
+    public:
+        /**
+         *  Constructor
+         */
+        SpscQueue();
+
+        /**
+         *  Adds a value to the back of the queue. Must only be called by the
+         *  producer thread.
+         *
+         *  @param value The value to add.
+         *  @return bool True if the value was added. False if the queue is
+         *  full.
+         */
+        bool Push(const T& value);
+
+        /**
+         *  Removes the value at the front of the queue. Must only be called by
+         *  the consumer thread.
+         *
+         *  @param out[out] The location to move the removed value to.
+         *  @return bool True if a value was removed. False if the queue is
+         *  empty.
+         */
+        bool Pop(T* out);
+
+    private:
+        /**< Holds queued values. One slot is always left empty. */
+        T slots_[N + 1];
+
+        /**< Index of the next value to pop. Written by the consumer. */
+        std::atomic<size_t> head_;
+
+        /**< Index of the next free slot. Written by the producer. */
+        std::atomic<size_t> tail_;
+    };
+}
+
+#include "SpscQueue.tcc"
+
+#endif // LIBRCSSCONTROLLER_SPSCQUEUE_H_
@@ -0,0 +1,53 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace librcsscontroller
+{
+    template <typename T, size_t N>
+    SpscQueue<T, N>::SpscQueue()
+        : head_{0}, tail_{0}
+    { }
+
+    template <typename T, size_t N>
+    bool SpscQueue<T, N>::Push(const T& value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % (N + 1);
+        if (next == head_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        slots_[tail] = value;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    template <typename T, size_t N>
+    bool SpscQueue<T, N>::Pop(T* out)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        *out = std::move(slots_[head]);
+        head_.store((head + 1) % (N + 1), std::memory_order_release);
+        return true;
+    }
+}
@@ -0,0 +1,138 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_THREADSAFELOGGER_H_
+#define LIBRCSSCONTROLLER_THREADSAFELOGGER_H_
+
+#include "Logger.h"
+
+#include <mutex>
+#include <utility>
+
+namespace librcsscontroller
+{
+    /**
+     *  The ThreadSafeLogger class logs through the Logger singleton from any
+     *  number of threads.
+     *
+     *  Logger and StreamGroupWriter are compiled into the library and write
+     *  straight to the subscribed streams, so messages logged by two threads
+     *  at once race on the streams and interleave. A message logged through
+     *  a ThreadSafeLogger holds a lock shared by the whole process from the
+     *  function call operator until the end of the statement, so it is
+     *  written in one piece:
+     *
+     *      log_(LogLevel::INFO) << "Test " << n << " completed.\n";
+     *
+     *  The lock is recursive, so a value logged in the statement may itself
+     *  log. Streams must still only be added and removed before other
+     *  threads start logging.
+     */
+    class ThreadSafeLogger
+    {
+    public:
+        /**
+         *  The Writer class writes one message while holding the logging
+         *  lock, which it releases when destroyed.
+         */
+        class Writer
+        {
+        public:
+            /**
+             *  Constructor
+             *
+             *  @param lock The held logging lock.
+             *  @param writer The StreamGroupWriter to write the message with.
+             */
+            Writer(std::unique_lock<std::recursive_mutex> lock,
+                   StreamGroupWriter writer)
+                : lock_{std::move(lock)}, writer_{std::move(writer)}
+            { }
+
+            /**
+             *  Stream Insertion Operator
+             *
+             *  Writes data to every stream subscribed to the message's level.
+             *
+             *  @tparam T The type of the data.
+             *  @param data The data to write.
+             *  @return Writer& This writer, to continue the message with.
+             */
+            template<typename T>
+            Writer& operator<<(const T& data)
+            {
+                writer_.Write(data);
+                return *this;
+            }
+
+        private:
+            std::unique_lock<std::recursive_mutex> lock_;   /**< Held while the message is written */
+            StreamGroupWriter writer_;                      /**< Writes to the subscribed streams */
+        };
+
+        /**
+         *  Constructor
+         */
+        ThreadSafeLogger()
+            : logger_(Logger::GetInstance())
+        { }
+
+        /**
+         *  Function Call Operator
+         *
+         *  Starts a message at a level, taking the logging lock.
+         *
+         *  @param level The LogLevel of the message.
+         *  @return Writer A Writer for the message, holding the lock until
+         *  the end of the statement.
+         */
+        Writer operator()(const LogLevel level)
+        {
+            std::unique_lock<std::recursive_mutex> lock(GetMutex());
+            return Writer(std::move(lock), logger_.GetWriter(level));
+        }
+
+        /**
+         *  Takes the logging lock outside of a message. Used around calls
+         *  into the library that log through Logger directly.
+         *
+         *  @return std::unique_lock<std::recursive_mutex> The held lock.
+         */
+        static std::unique_lock<std::recursive_mutex> Lock()
+        {
+            return std::unique_lock<std::recursive_mutex>(GetMutex());
+        }
+
+    private:
+        /**
+         *  Returns the lock shared by every ThreadSafeLogger in the process.
+         *
+         *  @return std::recursive_mutex& The logging lock.
+         */
+        static std::recursive_mutex& GetMutex()
+        {
+            static std::recursive_mutex mutex;
+            return mutex;
+        }
+
+        Logger& logger_;            /**< The logger written through */
+    };
+}
+
+#endif // LIBRCSSCONTROLLER_THREADSAFELOGGER_H_
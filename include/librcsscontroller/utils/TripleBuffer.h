@@ -0,0 +1,86 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRCSSCONTROLLER_TRIPLEBUFFER_H_
+#define LIBRCSSCONTROLLER_TRIPLEBUFFER_H_
+
+#include <atomic>
+
+namespace librcsscontroller
+{
+    /**
+     *  The TripleBuffer class hands the latest value of T from one writer
+     *  thread to one reader thread without locks or waiting.
+     *
+     *  The writer fills the buffer returned by GetWriteBuffer() and then calls
+     *  Publish(). The reader calls Read() to obtain the most recently
+     *  published value, which stays untouched by the writer until the reader
+     *  calls Read() again. Values published between two reads are skipped.
+     *
+     *  @tparam T The type of value to hand over.
+     */
+    template <typename T>
+    class TripleBuffer
+    {
+    public:
+        /**
+         *  Constructor
+         */
+        TripleBuffer();
+
+        /**
+         *  Returns the buffer the writer may fill before calling Publish().
+         *  Must only be called by the writer thread.
+         *
+         *  @return T& The buffer to write the next value to.
+         */
+        T& GetWriteBuffer();
+
+        /**
+         *  Publishes the value in the write buffer to the reader. Must only be
+         *  called by the writer thread.
+         */
+        void Publish();
+
+        /**
+         *  Returns the most recently published value. Must only be called by
+         *  the reader thread.
+         *
+         *  @return const T& The most recently published value. Remains valid
+         *  until the next call to Read().
+         */
+        const T& Read();
+
+    private:
+        /**< Flags that the shared buffer holds a value the reader has not seen */
+        constexpr static int FRESH = 4;
+
+        /**< Masks the buffer index out of the shared state */
+        constexpr static int INDEX_MASK = 3;
+
+        T buffers_[3];              /**< The write, shared and read buffers */
+        std::atomic<int> shared_;   /**< Index of the shared buffer, and FRESH */
+        int write_;                 /**< Index of the writer's buffer */
+        int read_;                  /**< Index of the reader's buffer */
+    };
+}
+
+#include "TripleBuffer.tcc"
+
+#endif // LIBRCSSCONTROLLER_TRIPLEBUFFER_H_
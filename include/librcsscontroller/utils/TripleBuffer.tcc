@@ -0,0 +1,50 @@
+/*
+ *  librcsscontroller
+ *  A library for controlling rcssserver3d simulations.
+ *  Copyright (C) 2017 Jeremy Collette.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace librcsscontroller
+{
+    template <typename T>
+    TripleBuffer<T>::TripleBuffer()
+        : shared_{1}, write_{0}, read_{2}
+    { }
+
+    template <typename T>
+    T& TripleBuffer<T>::GetWriteBuffer()
+    {
+        return buffers_[write_];
+    }
+
+    template <typename T>
+    void TripleBuffer<T>::Publish()
+    {
+        write_ = shared_.exchange(write_ | FRESH, std::memory_order_acq_rel) 
+            & INDEX_MASK;
+    }
+
+    template <typename T>
+    const T& TripleBuffer<T>::Read()
+    {
+        if (shared_.load(std::memory_order_relaxed) & FRESH)
+        {
+            read_ = shared_.exchange(read_, std::memory_order_acq_rel) 
+                & INDEX_MASK;
+        }
+        return buffers_[read_];
+    }
+}
@@ -0,0 +1,380 @@
+#include "Coordinator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace findballexp
+{
+    Coordinator::Coordinator(TestQueue& tests, ResultWriter& results,
+                             EventLoop& loop, const std::atomic<bool>& stopping,
+                             InstancePool* pool)
+        : tests_(tests), results_(results),
+          loop_(loop), stopping_(stopping), pool_(pool)
+    { }
+
+    Coordinator::~Coordinator()
+    {
+        for (auto& w : workers_)
+        {
+            if (w.state == RUNNING)
+            {
+                kill(w.pid, SIGKILL);
+                waitpid(w.pid, nullptr, 0);
+                close(w.fd);
+            }
+        }
+    }
+
+    bool Coordinator::Run(const int num_lanes, LaneFunction lane_function)
+    {
+        lane_function_ = lane_function;
+        buffer_.resize(WorkerLink::MAX_MESSAGE);
+
+        // Every lane starts out waiting, and is spawned by the first check
+        // (or once the pool has a warm instance for it)
+        workers_.reserve(num_lanes);
+        for (int i = 0; i < num_lanes; ++i)
+        {
+            workers_.push_back(Worker{i, i, WAITING, -1, -1, -1, false, 0, 0, 
+                                      0});
+        }
+        Check();
+
+        loop_.Schedule(CHECK_INTERVAL_MS);
+        bool signalled = false;
+        while (true)
+        {
+            bool active = false;
+            for (const auto& w : workers_)
+            {
+                active = active || w.state == RUNNING || w.state == WAITING;
+            }
+            if (!active)
+            {
+                break;
+            }
+
+            bool due = loop_.Wait();
+
+            // Pass SIGINT on, then keep collecting results until every
+            // worker has finished its experiment and exited
+            if (stopping_ && !signalled)
+            {
+                signalled = true;
+                for (auto& w : workers_)
+                {
+                    if (w.state == RUNNING)
+                    {
+                        kill(w.pid, SIGINT);
+                    }
+                    else if (w.state == WAITING)
+                    {
+                        w.state = FINISHED;
+                    }
+                }
+            }
+
+            for (auto& w : workers_)
+            {
+                if (w.state == RUNNING)
+                {
+                    Receive(&w);
+                }
+            }
+
+            if (due)
+            {
+                Check();
+                loop_.Schedule(CHECK_INTERVAL_MS);
+            }
+        }
+        loop_.Schedule(0);
+
+        bool result = true;
+        for (const auto& w : workers_)
+        {
+            result = result && w.state != RETIRED;
+        }
+        return result;
+    }
+
+    bool Coordinator::Spawn(Worker* w)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+        {
+            log_(LogLevel::ERROR) << "Error creating socket for lane "
+                                  << w->lane << ".\n";
+            return false;
+        }
+        int size = WorkerLink::MAX_MESSAGE;
+        setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+        // Anything still buffered would otherwise be written by both
+        // processes
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+
+        pid_t parent = getpid();
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            log_(LogLevel::ERROR) << "Error forking worker for lane "
+                                  << w->lane << ".\n";
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+
+        if (pid == 0)
+        {
+            // Worker: only keep its own end of its own socket, and stop if
+            // the coordinator dies
+            close(fds[0]);
+            for (const auto& other : workers_)
+            {
+                if (other.state == RUNNING)
+                {
+                    close(other.fd);
+                }
+            }
+            prctl(PR_SET_PDEATHSIG, SIGINT);
+            if (getppid() != parent)
+            {
+                _exit(EXIT_FAILURE);
+            }
+
+            int code;
+            {
+                WorkerLink link(fds[1]);
+                code = lane_function_(w->slot, link);
+            }
+            std::cout.flush();
+            std::cerr.flush();
+
+            // Skip destructors and atexit handlers, which belong to the
+            // coordinator
+            _exit(code);
+        }
+
+        close(fds[1]);
+        w->state = RUNNING;
+        w->pid = pid;
+        w->fd = fds[0];
+        w->test = -1;
+        w->done = false;
+        w->last_heard = GetClockMs();
+        loop_.Watch(w->fd);
+        log_(LogLevel::INFO) << "Started worker " << pid << " for lane "
+                             << w->lane << " on slot " << w->slot << ".\n";
+        return true;
+    }
+
+    void Coordinator::Receive(Worker* w)
+    {
+        while (w->state == RUNNING)
+        {
+            ssize_t n = recv(w->fd, buffer_.data(), buffer_.size(),
+                             MSG_DONTWAIT | MSG_TRUNC);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                          || errno == EINTR))
+            {
+                return;
+            }
+            if (n <= 0)
+            {
+                // The worker has exited
+                Reap(w);
+                return;
+            }
+            if (n > static_cast<ssize_t>(buffer_.size()))
+            {
+                log_(LogLevel::WARNING) << "Dropped oversized message from lane "
+                                        << w->lane << ".\n";
+                continue;
+            }
+            w->last_heard = GetClockMs();
+            Handle(w, buffer_.data(), n);
+        }
+    }
+
+    void Coordinator::Handle(Worker* w, const char* msg, const size_t size)
+    {
+        switch (msg[0])
+        {
+        case 'N':
+            if (tests_.Next(&w->test))
+            {
+                Send(w, "T" + std::to_string(w->test));
+            }
+            else
+            {
+                w->test = -1;
+                w->done = true;
+                Send(w, "D");
+            }
+            break;
+        case 'Q':
+        {
+            int index = std::atoi(std::string(msg + 1, size - 1).c_str());
+            log_(LogLevel::WARNING) << "Requeueing test no. " << index+1
+                                    << " from lane " << w->lane << ".\n";
+            tests_.Requeue(index);
+            w->test = -1;
+            break;
+        }
+        case 'W':
+        {
+            // W<test> <length>\n<test row><position rows>
+            const char* end = msg + size;
+            const char* header_end = std::find(msg, end, '\n');
+            if (header_end == end)
+            {
+                break;
+            }
+            std::string header(msg + 1, header_end);
+            int test = 0;
+            size_t length = 0;
+            if (std::sscanf(header.c_str(), "%d %zu", &test, &length) != 2
+                || length > static_cast<size_t>(end - header_end - 1))
+            {
+                break;
+            }
+            const char* rows = header_end + 1;
+            results_.Write(test, std::string(rows, length),
+                           std::string(rows + length, end));
+            w->test = -1;
+            w->failures = 0;
+            break;
+        }
+        default:
+            // Heartbeat
+            break;
+        }
+    }
+
+    void Coordinator::Reap(Worker* w)
+    {
+        loop_.Unwatch(w->fd);
+        close(w->fd);
+        w->fd = -1;
+
+        int status = 0;
+        while (waitpid(w->pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+
+        if (w->test >= 0)
+        {
+            log_(LogLevel::WARNING) << "Requeueing test no. " << w->test+1
+                                    << " from lane " << w->lane << ".\n";
+            tests_.Requeue(w->test);
+            w->test = -1;
+        }
+
+        bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (pool_)
+        {
+            pool_->Release(w->slot, !clean && !stopping_);
+        }
+        if ((clean && w->done) || stopping_)
+        {
+            log_(LogLevel::INFO) << "Worker for lane " << w->lane
+                                 << " finished.\n";
+            w->state = FINISHED;
+            return;
+        }
+
+        if (WIFSIGNALED(status))
+        {
+            log_(LogLevel::WARNING) << "Worker for lane " << w->lane
+                << " was killed by signal " << WTERMSIG(status) << ".\n";
+        }
+        else
+        {
+            log_(LogLevel::WARNING) << "Worker for lane " << w->lane
+                << " exited with code " << WEXITSTATUS(status) << ".\n";
+        }
+        Retry(w);
+    }
+
+    void Coordinator::Retry(Worker* w)
+    {
+        if (++w->failures >= MAX_FAILURES)
+        {
+            log_(LogLevel::ERROR) << "Lane " << w->lane << " failed "
+                                  << w->failures << " times. Retiring it.\n";
+            w->state = RETIRED;
+            return;
+        }
+        w->state = WAITING;
+        w->respawn_at = GetClockMs() + RESPAWN_DELAY_MS;
+    }
+
+    void Coordinator::Check()
+    {
+        if (pool_)
+        {
+            pool_->Check();
+        }
+
+        int64_t now = GetClockMs();
+        for (auto& w : workers_)
+        {
+            if (w.state == RUNNING && now - w.last_heard > STALL_TIMEOUT_MS)
+            {
+                log_(LogLevel::WARNING) << "Worker for lane " << w.lane
+                                        << " stalled. Killing it...\n";
+                kill(w.pid, SIGKILL);
+                Reap(&w);
+            }
+            else if (w.state == WAITING && now >= w.respawn_at && !stopping_)
+            {
+                if (pool_ && !pool_->Acquire(&w.slot))
+                {
+                    if (!pool_->IsAlive())
+                    {
+                        log_(LogLevel::ERROR) << "No instances left for lane "
+                                              << w.lane << ". Retiring it.\n";
+                        w.state = RETIRED;
+                    }
+                    continue;
+                }
+                if (w.pid > 0)
+                {
+                    log_(LogLevel::INFO) << "Respawning lane " << w.lane 
+                                         << "...\n";
+                }
+                if (!Spawn(&w))
+                {
+                    if (pool_)
+                    {
+                        pool_->Release(w.slot, false);
+                    }
+                    Retry(&w);
+                }
+            }
+        }
+    }
+
+    void Coordinator::Send(Worker* w, const std::string& msg)
+    {
+        send(w->fd, msg.data(), msg.size(), MSG_NOSIGNAL);
+    }
+
+    int64_t Coordinator::GetClockMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
@@ -1,11 +1,26 @@
+#include "Coordinator.h"
 #include "FindBallExperiment.h"
+#include "InstancePool.h"
+#include "Lane.h"
+#include "ResultWriter.h"
 #include "RoboCupGameControlData.hpp"
+#include "TestQueue.h"
+#include "WorkerLink.h"
 
 #include "agent/AgentServer.h"
-#include "simulator/SimulatorConnection.h"
+#include "simulator/AsyncSimulatorConnection.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <unistd.h>
 
 namespace findballexp
 {
@@ -26,15 +41,20 @@ namespace findballexp
             { {2.25, 0}, {4, -2.5}, {4, 2.5}, {4.5, 3},  {2.25, -3},
               {-4.5, 3}, {4.5, 0},  {-3.5, 0},{4.5, -3}, {-4.5, -1} };
 
-    FindBallExperiment::FindBallExperiment(SimulatorConnection& simulator, 
+    FindBallExperiment::FindBallExperiment(AsyncSimulatorConnection& simulator, 
                                         RunswiftAgentServer& agent_server,
-                                        const int start_from)
-        : simulator_(simulator), agent_server_(agent_server), 
-        start_index_{start_from-1}, log_(Logger::GetInstance()), 
-        state_{NOT_STARTED}, timer_{0}, counter_{start_from-1}, started_{false}, 
-        num_agents_{0}, start_in_{0}, last_log_{0}, mt_{0}, dist_{-1, 1}
+                                        EventLoop& loop,
+                                        TestSource& tests,
+                                        ResultSink& results,
+                                        const bool sync_mode)
+        : simulator_(simulator), 
+        agent_server_(agent_server), loop_(loop), tests_(tests), 
+        results_(results), state_{NOT_STARTED}, done_{false}, 
+        sync_mode_{sync_mode}, test_start_{0}, counter_{0}, num_agents_{0}, 
+        started_{false}, start_by_{0}, commands_sent_{false}, ack_ticket_{0},
+        last_log_{0}, mt_{0}, dist_{-1, 1}
     {
-        time(&timer_);
+        ResetTimer();
     }
 
     FindBallExperiment::~FindBallExperiment()
@@ -44,55 +64,6 @@ namespace findballexp
 
     bool FindBallExperiment::Init()
     {    
-        // For general logging
-        std::stringstream name;
-        name << "logs/" << timer_ << ".log";
-        log_file_.open(name.str(), std::ofstream::out);
-        if (log_file_.is_open())
-        {
-            log_.AddStream(&log_file_, LogLevel::INFO);
-            log_(LogLevel::INFO) << "Opened general log file '" 
-                << name.str() << "'\n";
-        }
-        else
-        {
-            log_(LogLevel::WARNING) << "Could not open log file '" 
-                << name.str() << "'\n";
-        }
-
-        // For experiment results
-        name.str("");
-        name << timer_ << "_test.csv";
-        tests_file_.open(name.str(), std::ofstream::out);
-        if (tests_file_.is_open())
-        {
-            log_(LogLevel::INFO) << "Opened tests output file '" << name.str() << "'\n";
-            log_.AddStream(&tests_file_, LogLevel::DEBUG_5, LogLevel::DEBUG_5, nullptr);      
-        }
-        else
-        {
-            log_(LogLevel::WARNING) << "Could not open tests output file '" 
-                << name.str() << "'\n";
-        }
-        log_(LogLevel::DEBUG_5) << "Test,BallX,BallY,Robots,Seconds,FoundBy\n";
-
-        // For robot positions
-        name.str("");
-        name << timer_ << "_pos.csv";
-        pos_file_.open(name.str(), std::ofstream::out);
-        if (pos_file_.is_open())
-        {
-            log_(LogLevel::INFO) << "Opened positions output file '" 
-                << name.str() << "'\n";
-            log_.AddStream(&pos_file_, LogLevel::DEBUG_4, LogLevel::DEBUG_4, nullptr);        
-        }
-        else
-        {
-            log_(LogLevel::WARNING) << "Could not open positions output file '" << name.str() << "'\n";
-        }
-        log_(LogLevel::DEBUG_4) 
-            << "Test,Seconds,Robot1Pos,Robot2Pos,Robot3Pos,Robot4Pos,Robot5Pos\n";
-
         log_(LogLevel::INFO) << "Waiting for agents to connect...\n";
         return true;
     }
@@ -133,7 +104,7 @@ namespace findballexp
         }
         agent_server_.Send(response); 
 
-        return true;
+        return !done_;
     }
 
     bool FindBallExperiment::Finish()
@@ -141,12 +112,22 @@ namespace findballexp
         CancelExperiment();
 
         log_(LogLevel::INFO) << "Shutting down experiment...\n";
-        tests_file_.close();
-        pos_file_.close();
-        log_file_.close();
         return true;
     }
 
+    void FindBallExperiment::Abort()
+    {
+        // A prepared test has a row that has not been written yet
+        if (test_row_.tellp() > 0)
+        {
+            log_(LogLevel::WARNING) << "Abandoning test no. " << counter_+1 
+                                    << ".\n";
+            tests_.Requeue(counter_);
+            test_row_.str("");
+            pos_rows_.str("");
+        }
+    }
+
 
     bool FindBallExperiment::HandleNotStarted()
     {
@@ -160,17 +141,34 @@ namespace findballexp
 
     bool FindBallExperiment::HandleStarting()
     {
-        if (start_in_ == 0)
+        if (!commands_sent_)
         {
-            simulator_.SendSelectPlayerCommand(simulator_.GetLastUpdate().players[0]);  
-            SetExperimentState(TEST_STARTED);
+            // Wait (for up to START_WAIT_MS) until the simulator reports a
+            // robot for every agent, so they can all be moved
+            size_t players = simulator_.GetLastUpdate()->GetPlayers().size();
+            if ((players == 0 || players < static_cast<size_t>(num_agents_))
+                && GetClockMs() < start_by_)
+            {
+                return true;
+            }
+
+            if (!PrepareExperiment())
+            {
+                return true;
+            }
+            ack_ticket_ = simulator_.GetTicket(PREPARE_WAIT_MESSAGES);
+            commands_sent_ = true;
         }
-        
-        if (start_in_ == 50)
+        else if (simulator_.IsAcknowledged(ack_ticket_))
         {
-            PrepareExperiment();
+            // Robots and ball are in place
+            auto su = simulator_.GetLastUpdate();
+            if (!su->GetPlayers().empty())
+            {
+                simulator_.SendSelectPlayerCommand(su->GetPlayers()[0]);
+            }
+            SetExperimentState(TEST_STARTED);
         }
-        --start_in_;
         
         return true;
     }
@@ -179,19 +177,20 @@ namespace findballexp
     {
         if (HasNewAgent())
         {
-            log_(LogLevel::INFO) << "New agent detected. Restarting experiment...\n";
-            CancelExperiment();
-            counter_ = start_index_;
+            // Only this lane's test is run again, with the new agent. Other
+            // lanes share the sweep, so it must not be rewound
+            log_(LogLevel::INFO) << "New agent detected. Restarting test...\n";
+            Abort();
             SetExperimentState(TEST_STARTING);
             return true;
         }        
     
         std::vector<Agent> found_by;
-        int time = GetTimerSeconds();
-        bool finish = time > FIND_BALL_TIMEOUT || (IsBallFound(&found_by) && time > 1);
+        int time_ms = GetTimerMs();
+        bool finish = time_ms > FIND_BALL_TIMEOUT*1000 || IsBallFound(&found_by);
         if (finish)
         {
-            FinishExperiment(time, found_by);
+            FinishExperiment(time_ms, found_by);
             SetExperimentState(TEST_FINISHED);
         }
         return true;
@@ -199,16 +198,17 @@ namespace findballexp
 
     bool FindBallExperiment::HandleFinished()
     {
-        if (start_in_ == 300)
+        if (!commands_sent_)
         {
             // Move ball out of bounds so we don't detect it
             simulator_.SendMoveBallCommand(10000.0f, 10000.0f, 0.0f);
+            ack_ticket_ = simulator_.GetTicket(RESET_WAIT_MESSAGES);
+            commands_sent_ = true;
         }
-        else if (start_in_ == 150)
+        else if (simulator_.IsAcknowledged(ack_ticket_))
         {
             SetExperimentState(TEST_STARTING);
         }
-        --start_in_;
         
         return true;
     }
@@ -217,23 +217,27 @@ namespace findballexp
     {
         log_(LogLevel::INFO) << "Changing experiment state from "
                 << StateToString(state_) << " to " << StateToString(s) << "\n";
+        commands_sent_ = false;
         switch (s)
         {
             case NOT_STARTED:
-                start_in_ = 0;
                 started_ = false;
                 break;
             case TEST_STARTING:
-                start_in_ = 150;
+                // In real time, tick at the deadline even if the simulator
+                // goes quiet. Simulator time stops when it does.
+                start_by_ = GetClockMs() + START_WAIT_MS;
+                if (!sync_mode_)
+                {
+                    loop_.Schedule(START_WAIT_MS);
+                }
                 started_ = false;
                 break;
             case TEST_STARTED:                
-                start_in_ = 0;
                 started_ = true;
                 StartExperiment();
                 break;
             case TEST_FINISHED:
-                start_in_ = 300;
                 started_ = false;
                 break;
         }
@@ -243,14 +247,21 @@ namespace findballexp
 
     bool FindBallExperiment::PrepareExperiment()
     {
+        if (!tests_.Next(&counter_))
+        {
+            log_(LogLevel::INFO) << "No tests left to run.\n";
+            done_ = true;
+            return false;
+        }
         log_(LogLevel::INFO) << "Preparing test no. " << counter_+1 << "...\n";
 
-        SimulatorUpdate su = simulator_.GetLastUpdate();
+        auto su = simulator_.GetLastUpdate();
+        const std::vector<Player>& players = su->GetPlayers();
 
         // Move players to starting positions
-        for (int i=0; i < su.players.size(); ++i)
+        for (int i=0; i < players.size(); ++i)
         {
-            Player p = su.players[i];   
+            const Player& p = players[i];
             float x, y, z, o;
             z = 0.4;
             if (GetStartingPosition(p.number, &x, &y, &o))
@@ -285,29 +296,53 @@ namespace findballexp
 
         // Save data
         // Fields: Test, BallX, BallY, Robots, (Seconds, FoundBy)\n
-        log_(LogLevel::DEBUG_5) << counter_+1 << "," << ball_x*1000 << "," 
-                                << ball_y*1000 << "," << su.players.size() 
-                                << ",";
-
+        test_row_.str("");
+        pos_rows_.str("");
+        test_row_ << counter_+1 << "," << ball_x*1000 << "," << ball_y*1000 
+                  << "," << players.size() << ",";
+        return true;
     }
 
     bool FindBallExperiment::StartExperiment()
     {
         ResetTimer();
+        last_log_ = -1;
+
+        // Updates sent before the test started may still report the ball at
+        // its old position, so only later updates can find it
+        for (auto& a : agent_server_.GetAgents())
+        {
+            uint64_t sequence;
+            if (agent_server_.ViewLastUpdate(a, &sequence))
+            {
+                if (static_cast<size_t>(a.id) >= ball_checks_.size())
+                {
+                    ball_checks_.resize(a.id + 1);
+                }
+                ball_checks_[a.id].sequence = sequence;
+                ball_checks_[a.id].sees_ball = false;
+            }
+        }
         log_(LogLevel::INFO) << "New test started!\n";
         return true;
     }
 
-    bool FindBallExperiment::FinishExperiment(int time, 
+    bool FindBallExperiment::FinishExperiment(int time_ms, 
            const std::vector<Agent>& found_by)
     {   
+        // Nothing to record unless a test was prepared
+        if (test_row_.tellp() <= 0)
+        {
+            return true;
+        }
+
         std::string found_str = "";
         for (auto itr = found_by.begin(); itr != found_by.end(); ++itr)
         {
-            FromRunswiftAgent update;
-            if (agent_server_.GetLastUpdate(*itr, &update))
+            const FromRunswiftAgent* update = agent_server_.ViewLastUpdate(*itr);
+            if (update)
             {
-                found_str += '0' + update.player_number;
+                found_str += '0' + update->player_number;
                 if (itr != found_by.end()-1) found_str += ";";
             }
         }
@@ -318,13 +353,14 @@ namespace findballexp
 
         log_(LogLevel::INFO) << "Test " << counter_+1 << " completed. Ball found"
             << " by " << (found_str  == "-1" ? "nobody" : found_str)
-            << " in " << time << " seconds.\n";
+            << " in " << FormatSeconds(time_ms) << " seconds.\n";
 
         // Save data
         // Fields: (Test, BallX, BallY, Robots), Seconds, FoundBy\n
-        log_(LogLevel::DEBUG_5) << time << "," << found_str << "\n";
-
-        ++counter_;
+        test_row_ << FormatSeconds(time_ms) << "," << found_str << "\n";
+        results_.Write(counter_+1, test_row_.str(), pos_rows_.str());
+        test_row_.str("");
+        pos_rows_.str("");
         return true;
     }
 
@@ -334,20 +370,19 @@ namespace findballexp
             || GetExperimentState() == NOT_STARTED)
         {
             std::vector<Agent> agents;
-            return FinishExperiment(GetTimerSeconds(), agents);
+            return FinishExperiment(GetTimerMs(), agents);
         }
         return true;
     }
 
     void FindBallExperiment::ResetTimer()
     {
-        time(&timer_);
+        test_start_ = GetClockMs();
     }
 
     bool FindBallExperiment::CheckSimulatorGameState()
     {
-        auto su = simulator_.GetLastUpdate();
-        if (su.play_mode == PlayMode::BEFORE_KICK_OFF)
+        if (simulator_.GetLastUpdate()->GetPlayMode() == PlayMode::BEFORE_KICK_OFF)
         {
             return simulator_.SendPlayModeCommand(PlayMode::GAME_OVER);
         }
@@ -356,33 +391,59 @@ namespace findballexp
 
     bool FindBallExperiment::LogAgentPositions()
     {
-        auto time = GetTimerSeconds();
+        int time = GetTimerMs() / 1000;
         if (!started_ || last_log_ == time)
         {
             return false;
         }
         last_log_ = time;
 
-        FromRunswiftAgent updates[5];
+        // Robots without an update are logged with default values
+        const FromRunswiftAgent none;
+        const FromRunswiftAgent* updates[5] = {&none, &none, &none, &none, &none};
 
         auto agents = agent_server_.GetAgents();
         for (int i=0; i < 5 && i < agents.size(); ++i)
         {
-            FromRunswiftAgent u;
-            agent_server_.GetLastUpdate(agents[i], &u);
-            updates[u.player_number-1] = u;
+            const FromRunswiftAgent* u = agent_server_.ViewLastUpdate(agents[i]);
+            if (u && u->player_number >= 1 && u->player_number <= 5)
+            {
+                updates[u->player_number-1] = u;
+            }
         }
 
-        // CSV format: "Test,Seconds,Robot1,Robot2,Robot3,Robot4,Robot5\n";
-        log_(LogLevel::DEBUG_4) << counter_+1 << "," << GetTimerSeconds();
+        // CSV format: "Test,Seconds,Robot1,Robot2,Robot3,Robot4,Robot5,Ball\n";
+        // Robots are "x;y;o;true_x;true_y;true_o", with true values left 
+        // empty if the simulator has not reported the robot.
+        const SceneGraph& scene = simulator_.GetScene();
+        pos_rows_ << counter_+1 << "," << time;
 
         for (int i=0; i < 5; ++i)
         {
-            log_(LogLevel::DEBUG_4) << "," << updates[i].estimated_x_pos << ";"
-                                    << updates[i].estimated_y_pos << ";"
-                                    << updates[i].estimated_orientation;
+            pos_rows_ << "," << updates[i]->estimated_x_pos << ";"
+                      << updates[i]->estimated_y_pos << ";"
+                      << updates[i]->estimated_orientation << ";";
+
+            const SceneGraph::Robot* robot = scene.FindRobot(i+1, AGENT_TEAM);
+            if (robot)
+            {
+                pos_rows_ << robot->pose.x*1000 << ";" 
+                          << robot->pose.y*1000 << ";"
+                          << robot->pose.orientation;
+            }
+            else
+            {
+                pos_rows_ << ";;";
+            }
+        }
+
+        SceneGraph::Pose ball;
+        pos_rows_ << ",";
+        if (scene.GetBallPose(&ball))
+        {
+            pos_rows_ << ball.x*1000 << ";" << ball.y*1000;
         }
-        log_(LogLevel::DEBUG_4) << "\n";
+        pos_rows_ << "\n";
 
         return true;
     }
@@ -400,11 +461,27 @@ namespace findballexp
         return new_agent;
     }
 
-    int FindBallExperiment::GetTimerSeconds()
+    int FindBallExperiment::GetTimerMs()
     {
-        time_t new_time;
-        time(&new_time);
-        return difftime(new_time, timer_);
+        return GetClockMs() - test_start_;
+    }
+
+    int64_t FindBallExperiment::GetClockMs()
+    {
+        if (sync_mode_)
+        {
+            return std::llround(simulator_.GetLastUpdate()->GetTime() * 1000);
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::string FindBallExperiment::FormatSeconds(int time_ms)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%d.%03d", time_ms / 1000, 
+                 time_ms % 1000);
+        return buffer;
     }
     
     bool FindBallExperiment::IsBallFound(std::vector<Agent>* found_by)
@@ -413,25 +490,51 @@ namespace findballexp
         auto agents = agent_server_.GetAgents();
         for (auto& a : agents)
         {
-            FromRunswiftAgent u;
-            if (agent_server_.GetLastUpdate(a, &u))
+            uint64_t sequence;
+            const FromRunswiftAgent* u = agent_server_.ViewLastUpdate(a, &sequence);
+            if (!u)
             {
-                // Hack dist for ball point 10
-                if (u.ball_seen_count >= FIND_BALL_SEEN_FRAMES 
-                    && u.can_see_ball 
-                    && u.dist_from_ball <= FIND_BALL_MAX_DIST)
+                continue;
+            }
+
+            // Only re-check agents that have sent a new update
+            if (static_cast<size_t>(a.id) >= ball_checks_.size())
+            {
+                ball_checks_.resize(a.id + 1);
+            }
+            BallCheck& check = ball_checks_[a.id];
+            if (check.sequence != sequence)
+            {
+                check.sequence = sequence;
+                check.sees_ball = u->ball_seen_count >= FIND_BALL_SEEN_FRAMES 
+                    && u->can_see_ball;
+            }
+
+            // The ball moves relative to the robot even without new updates
+            if (check.sees_ball && GetBallDistance(*u) <= FIND_BALL_MAX_DIST)
+            {
+                found = true;
+                if (found_by)
                 {
-                    found = true;
-                    if (found_by)
-                    {
-                        found_by->push_back(a);
-                    }
+                    found_by->push_back(a);
                 }
             }
         }
         return found;
     }
 
+    float FindBallExperiment::GetBallDistance(const FromRunswiftAgent& update)
+    {
+        const SceneGraph& scene = simulator_.GetScene();
+        const SceneGraph::Robot* robot = scene.FindRobot(update.player_number, AGENT_TEAM);
+        SceneGraph::Pose ball;
+        if (!robot || !scene.GetBallPose(&ball))
+        {
+            return update.dist_from_ball;
+        }
+        return std::hypot(ball.x - robot->pose.x, ball.y - robot->pose.y) * 1000;
+    }
+
     bool FindBallExperiment::GetStartingPosition(int player_num, float* x_out, float* y_out, float* o_out)
     {
         switch (player_num)
@@ -491,84 +594,432 @@ namespace findballexp
 }
 
 using namespace findballexp;
-FindBallExperiment* experiment = nullptr;
 
-void signal_handler(int signal)
+/**< How long a lane waits for a warm instance before checking for SIGINT */
+const int POOL_WAIT_MS = 200;
+
+/**< Set once SIGINT is received, to shut every lane down */
+std::atomic<bool> stopping{false};
+
+/**< The notify eventfd of every event loop in this process, to wake them on 
+ *   SIGINT */
+std::vector<int> lane_notify_fds;
+
+void signal_handler(int)
 {
-    std::cout << "\nSIGNAL DETECTED. Shutting down...\n";
-    if (experiment)
+    // Only async-signal-safe calls here. Each lane finishes its experiment
+    // on its own thread once woken. A coordinator passes the signal on to
+    // its workers.
+    const char msg[] = "\nSIGNAL DETECTED. Shutting down...\n";
+    write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+    stopping = true;
+    uint64_t one = 1;
+    for (int fd : lane_notify_fds)
     {
-        experiment->Finish();
+        write(fd, &one, sizeof(one));
     }
-    delete experiment;
-    experiment = nullptr;
-    abort();
 }
 
-
-int run_experiment(int start_from)
+/**
+ *  Runs one lane's experiment until every test is taken or SIGINT is 
+ *  received.
+ *
+ *  @param lane The lane's ports and names.
+ *  @param transport The agent transport: tcp, unix or shm.
+ *  @param sync_mode Indicates the simulator runs in sync mode.
+ *  @param loop The lane's event loop.
+ *  @param tests The queue shared by every lane.
+ *  @param results The result writer shared by every lane.
+ *  @param link The link to the coordinator to send heartbeats on, if the
+ *  lane runs in a worker process. Otherwise nullptr.
+ *  @return int 0 indicates success. 6 indicates the simulator was lost.
+ *  Otherwise indicates the step that failed.
+ */
+int run_lane(const Lane& lane, const std::string& transport, bool sync_mode,
+             EventLoop& loop, TestSource& tests, ResultSink& results,
+             WorkerLink* link = nullptr)
 {
-    signal(SIGPIPE, SIG_IGN);
-
-    Logger& log = Logger::GetInstance();
-    log.AddStream(&std::cout, LogLevel::DEBUG, LogLevel::INFO);
-    log.AddStream(&std::cerr, LogLevel::WARNING);
-
-    log(LogLevel::INFO) << "Running econtroller experiment...\n";      
+    ThreadSafeLogger log;
     EndpointConnection sim_ec;
-    if (!sim_ec.Init("localhost", 3200))
+    bool connected;
+    {
+        // EndpointConnection logs through Logger directly
+        auto lock = ThreadSafeLogger::Lock();
+        connected = sim_ec.Init("localhost", lane.simulator_port);
+    }
+    if (!connected)
     {
         log(LogLevel::ERROR) << "Error initialising connection to simulator.\n";
         return 1;
     }
-    log(LogLevel::INFO) << "Connected to simulator on port 3200!\n";
+    log(LogLevel::INFO) << "Connected to simulator on port " 
+                        << lane.simulator_port << "!\n";
     
-    SimulatorConnection simulator;
+    AsyncSimulatorConnection simulator;
     if (!simulator.Init(sim_ec))
     {
         log(LogLevel::ERROR) << "Error initialising connection to simulator.\n";
         return 2;
     }
 
+    // Agents running on this machine may use a local transport instead of
+    // TCP
     AgentServer<FromRunswiftAgent, ToRunswiftAgent> agent_server;
-    if (!agent_server.Init(3232))
+    if (transport == "unix")
+    {
+        if (!agent_server.InitUnix(lane.unix_path))
+        {
+            log(LogLevel::ERROR) << "Error initialising agent server.\n";
+            return 3;
+        }
+        log(LogLevel::INFO) << "Listening for agents on " << lane.unix_path 
+                            << "...\n";
+    }
+    else if (transport == "shm")
+    {
+        if (!agent_server.InitSharedMemory(lane.shm_name, 5))
+        {
+            log(LogLevel::ERROR) << "Error initialising agent server.\n";
+            return 3;
+        }
+        log(LogLevel::INFO) << "Waiting for agents on " << lane.shm_name 
+                            << ".1-5...\n";
+    }
+    else
+    {
+        if (!agent_server.Init(lane.agent_port))
+        {
+            log(LogLevel::ERROR) << "Error initialising agent server.\n";
+            return 3;
+        }
+        log(LogLevel::INFO) << "Listening for agents on port " 
+                            << lane.agent_port << "...\n";
+    }
+
+    // Agents may also send their state over UDP, like to a GameController
+    if (agent_server.InitDatagram(lane.datagram_port))
+    {
+        log(LogLevel::INFO) << "Listening for agent datagrams on port " 
+                            << lane.datagram_port << "...\n";
+    }
+    else
+    {
+        log(LogLevel::WARNING) << "Error initialising agent datagram socket. "
+                               << "Only TCP agents will be accepted.\n";
+    }
+
+    // Keep agent socket I/O off the experiment thread
+    if (!agent_server.Start())
     {
-        log(LogLevel::ERROR) << "Error initialising agent server.\n";
+        log(LogLevel::ERROR) << "Error starting agent server thread.\n";
         return 3;
     }
-    log(LogLevel::INFO) << "Listening for agents on port 3232...\n";
 
-    experiment = new FindBallExperiment(simulator, agent_server, start_from);
-    experiment->Init();
-    while(true)
+    // Likewise keep simulator socket I/O and message decoding off it
+    if (!simulator.Start())
+    {
+        log(LogLevel::ERROR) << "Error starting simulator thread.\n";
+        return 2;
+    }
+
+    // Sleep until either I/O thread publishes something new, or the
+    // experiment's scheduled tick is due
+    simulator.SetNotifyFd(loop.GetNotifyFd());
+    agent_server.SetNotifyFd(loop.GetNotifyFd());
+
+    FindBallExperiment experiment(simulator, agent_server, loop, tests, 
+                                  results, sync_mode);
+    experiment.Init();
+    while (!stopping)
     {
-        simulator.Tick();
+        bool due = loop.Wait();
+        if (link)
+        {
+            link->Heartbeat();
+        }
+        if (!simulator.Tick())
+        {
+            log(LogLevel::ERROR) << "Lost connection to simulator on port "
+                                 << lane.simulator_port << ".\n";
+            experiment.Abort();
+            return 6;
+        }
         agent_server.Tick();
-        if (!experiment->Tick())
+
+        // Tick the experiment once per simulator update, or when it asked
+        // to be woken
+        if ((simulator.IsUpdated() || due) && !experiment.Tick())
         {
             break;
         }
-        usleep(10);
+
+        // Everything the experiment queued this tick goes out as one message
+        simulator.Flush();
     }
-    experiment->Finish();
+    experiment.Finish();
+    simulator.Flush();
     return 0;
 }
 
-int main(int argc, char** argv)
+/**
+ *  Runs one lane's experiment on instances taken from a pool, moving on to
+ *  a warm instance whenever the lane loses its simulator.
+ *
+ *  @param index The lane's index.
+ *  @param pool The pool shared by every lane.
+ *  @param transport The agent transport: tcp, unix or shm.
+ *  @param sync_mode Indicates the simulator runs in sync mode.
+ *  @param loop The lane's event loop.
+ *  @param tests The queue shared by every lane.
+ *  @param results The result writer shared by every lane.
+ *  @return int 0 indicates success. 7 indicates the pool has no instances
+ *  left.
+ */
+int run_pooled_lane(int index, InstancePool& pool, const std::string& transport,
+                    bool sync_mode, EventLoop& loop, TestSource& tests, 
+                    ResultSink& results)
 {
+    ThreadSafeLogger log;
+    while (!stopping)
+    {
+        int slot;
+        if (!pool.Acquire(&slot, POOL_WAIT_MS))
+        {
+            if (!pool.IsAlive())
+            {
+                log(LogLevel::ERROR) << "No instances left for lane " << index 
+                                     << ".\n";
+                return 7;
+            }
+            continue;
+        }
+
+        log(LogLevel::INFO) << "Lane " << index << " is running on slot " 
+                            << slot << ".\n";
+        int result = run_lane(Lane::Make(slot), transport, sync_mode, loop, 
+                              tests, results);
+        pool.Release(slot, result != 0);
+        if (result == 0)
+        {
+            break;
+        }
+        log(LogLevel::WARNING) << "Lane " << index << " lost its instance. "
+                               << "Taking a warm one from the pool...\n";
+    }
+    return 0;
+}
+
+int run_experiment(int start_from, const std::string& transport, 
+                   bool sync_mode, int num_lanes, int num_tests, 
+                   bool processes, const InstancePool::Config* pool_config)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    // Streams are added before any lane starts, so only messages need the
+    // lock
+    Logger& logger = Logger::GetInstance();
+    logger.AddStream(&std::cout, LogLevel::DEBUG, LogLevel::INFO);
+    logger.AddStream(&std::cerr, LogLevel::WARNING);
+    ThreadSafeLogger log;
+
+    log(LogLevel::INFO) << "Running econtroller experiment...\n";      
+
+    // For general logging
+    time_t timer;
+    time(&timer);
+    std::ofstream log_file;
+    if (processes)
+    {
+        // Workers share the file, so each write must go straight out
+        log_file.rdbuf()->pubsetbuf(nullptr, 0);
+    }
+    log_file.open("logs/" + std::to_string(timer) + ".log", 
+                           std::ofstream::out);
+    if (log_file.is_open())
+    {
+        logger.AddStream(&log_file, LogLevel::INFO);
+        log(LogLevel::INFO) << "Opened general log file 'logs/" << timer 
+                            << ".log'\n";
+    }
+    else
+    {
+        log(LogLevel::WARNING) << "Could not open log file 'logs/" << timer 
+                               << ".log'\n";
+    }
+
+    // Every lane writes to the same output files, in test order
+    ResultWriter results;
+    results.Open(std::to_string(timer), start_from);
+    TestQueue tests(start_from-1, num_tests);
+
+    // Simulators and agents are either started by hand, or started and
+    // supervised here, with spare instances kept warm
+    std::unique_ptr<InstancePool> pool;
+    if (pool_config)
+    {
+        pool.reset(new InstancePool(*pool_config));
+        if (!pool->Start(std::min(Lane::MAX_LANES, 
+                                  num_lanes + pool_config->num_spares)))
+        {
+            return 8;
+        }
+    }
+
+    // Event loops are created up front, so SIGINT can wake every lane. A
+    // coordinator only needs one, and each worker makes its own. Lane 
+    // threads sharing a pool get one more, for this thread to supervise it.
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    int num_loops = processes ? 1 : num_lanes + (pool ? 1 : 0);
+    for (int i = 0; i < num_loops; ++i)
+    {
+        loops.emplace_back(new EventLoop());
+        if (!loops.back()->Init())
+        {
+            log(LogLevel::ERROR) << "Error initialising event loop.\n";
+            return 4;
+        }
+        lane_notify_fds.push_back(loops.back()->GetNotifyFd());
+    }
     std::signal(SIGINT, signal_handler);
-    
+
+    int result = 0;
+    if (processes)
+    {
+        log(LogLevel::INFO) << "Running " << num_lanes 
+                            << " lanes in worker processes...\n";
+        Coordinator coordinator(tests, results, *loops[0], stopping, 
+                                pool.get());
+        bool ok = coordinator.Run(num_lanes, [&](int slot, WorkerLink& link)
+        {
+            // The worker's loop is the only one SIGINT needs to wake
+            EventLoop loop;
+            if (!loop.Init())
+            {
+                log(LogLevel::ERROR) << "Error initialising event loop.\n";
+                return 4;
+            }
+            lane_notify_fds.resize(1);
+            lane_notify_fds[0] = loop.GetNotifyFd();
+            return run_lane(Lane::Make(slot), transport, sync_mode, loop, 
+                            link, link, &link);
+        });
+        if (!ok)
+        {
+            log(LogLevel::ERROR) << "Some lanes failed.\n";
+            result = 5;
+        }
+    }
+    else if (num_lanes == 1 && !pool)
+    {
+        result = run_lane(Lane::Make(0), transport, sync_mode, *loops[0], 
+                          tests, results);
+    }
+    else
+    {
+        log(LogLevel::INFO) << "Running " << num_lanes << " lanes...\n";
+        std::vector<int> lane_results(num_lanes);
+        std::vector<std::thread> lanes;
+        std::atomic<int> running{num_lanes};
+        for (int i = 0; i < num_lanes; ++i)
+        {
+            lanes.emplace_back([&, i]() 
+            {
+                if (!pool)
+                {
+                    lane_results[i] = run_lane(Lane::Make(i), transport, 
+                        sync_mode, *loops[i], tests, results);
+                    return;
+                }
+                lane_results[i] = run_pooled_lane(i, *pool, transport, 
+                    sync_mode, *loops[i], tests, results);
+                --running;
+                uint64_t one = 1;
+                write(loops.back()->GetNotifyFd(), &one, sizeof(one));
+            });
+        }
+
+        // Health-check the pool while the lanes run
+        while (pool && running > 0)
+        {
+            loops.back()->Wait(InstancePool::CHECK_INTERVAL_MS);
+            pool->Check();
+        }
+
+        for (int i = 0; i < num_lanes; ++i)
+        {
+            lanes[i].join();
+            if (lane_results[i] != 0)
+            {
+                log(LogLevel::ERROR) << "Lane " << i << " failed.\n";
+                result = lane_results[i];
+            }
+        }
+    }
+
+    results.Close();
+    logger.RemoveStream(&log_file);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
     int start_from = 1;
     if (argc > 1)
     {
         start_from = std::stoi(argv[1]);
     }    
 
-    run_experiment(start_from);
-    if (experiment)
+    // Agent transport: tcp (default), unix or shm
+    std::string transport = "tcp";
+    if (argc > 2)
     {
-        delete experiment;
-        experiment = nullptr;
+        transport = argv[2];
     }
-    return 0;
-}
\ No newline at end of file
+
+    // Timing mode: realtime (default) or sync, for a simulator running in
+    // sync mode, where time only advances as fast as physics is stepped
+    bool sync_mode = false;
+    if (argc > 3)
+    {
+        sync_mode = std::string(argv[3]) == "sync";
+    }
+
+    // Lanes: how many simulators to run tests on in parallel
+    int num_lanes = 1;
+    if (argc > 4)
+    {
+        num_lanes = std::max(1, std::min(Lane::MAX_LANES, std::stoi(argv[4])));
+    }
+
+    // Tests: how many tests to run, or -1 (default) to run until stopped
+    int num_tests = -1;
+    if (argc > 5)
+    {
+        num_tests = std::stoi(argv[5]);
+    }
+
+    // Isolation: threads (default) runs every lane in this process, while
+    // processes runs each in a worker process that is respawned if it dies
+    bool processes = false;
+    if (argc > 6)
+    {
+        processes = std::string(argv[6]) == "processes";
+    }
+
+    // Instances: setting FINDBALLEXP_SIMULATOR has simulators and agents
+    // started and supervised by findballexp, instead of by hand
+    std::unique_ptr<InstancePool::Config> pool_config;
+    if (const char* simulator_command = getenv("FINDBALLEXP_SIMULATOR"))
+    {
+        const char* agent_command = getenv("FINDBALLEXP_AGENT");
+        const char* num_agents = getenv("FINDBALLEXP_AGENTS");
+        const char* num_spares = getenv("FINDBALLEXP_SPARES");
+        pool_config.reset(new InstancePool::Config{simulator_command, 
+            agent_command ? agent_command : "",
+            num_agents ? std::stoi(num_agents) : 5,
+            num_spares ? std::max(0, std::stoi(num_spares)) : 1});
+    }
+
+    return run_experiment(start_from, transport, sync_mode, num_lanes, 
+                          num_tests, processes, pool_config.get());
+}
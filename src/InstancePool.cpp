@@ -0,0 +1,366 @@
+#include "InstancePool.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace findballexp
+{
+    InstancePool::InstancePool(const Config& config)
+        : config_(config)
+    { }
+
+    InstancePool::~InstancePool()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Give every process the chance to shut down cleanly first
+        std::vector<pid_t> groups;
+        for (auto& inst : instances_)
+        {
+            if (inst.simulator > 0)
+            {
+                groups.push_back(inst.simulator);
+            }
+            groups.insert(groups.end(), inst.agents.begin(), inst.agents.end());
+        }
+        for (pid_t pg : groups)
+        {
+            kill(-pg, SIGTERM);
+        }
+
+        int64_t deadline = GetClockMs() + STOP_TIMEOUT_MS;
+        for (pid_t pg : groups)
+        {
+            while (waitpid(pg, nullptr, WNOHANG) == 0)
+            {
+                if (GetClockMs() >= deadline)
+                {
+                    kill(-pg, SIGKILL);
+                    waitpid(pg, nullptr, 0);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+    }
+
+    bool InstancePool::Start(const int num_instances)
+    {
+        if (num_instances > Lane::MAX_LANES)
+        {
+            log_(LogLevel::ERROR) << "Cannot run more than " << Lane::MAX_LANES
+                                  << " instances.\n";
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int i = 0; i < num_instances; ++i)
+            {
+                instances_.push_back(Instance{Lane::Make(i), COLD, false, -1,
+                                              {}, 0, 0, 0});
+            }
+        }
+        log_(LogLevel::INFO) << "Starting " << num_instances
+                             << " simulator instances...\n";
+        Check();
+        return true;
+    }
+
+    bool InstancePool::Acquire(int* slot, const int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Instance* found = nullptr;
+        auto ready = [&]()
+        {
+            bool alive = false;
+            for (auto& inst : instances_)
+            {
+                if (inst.state == WARM && !inst.in_use)
+                {
+                    found = &inst;
+                    return true;
+                }
+                alive = alive || inst.state != GIVEN_UP;
+            }
+            return !alive;
+        };
+        warmed_.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+
+        if (!found)
+        {
+            return false;
+        }
+        found->in_use = true;
+        *slot = found->lane.index;
+        return true;
+    }
+
+    void InstancePool::Release(const int slot, const bool failed)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Instance& inst = instances_[slot];
+        inst.in_use = false;
+        if (failed && inst.state == WARM)
+        {
+            Fail(&inst, "lost by its lane");
+        }
+        else
+        {
+            warmed_.notify_all();
+        }
+    }
+
+    void InstancePool::Check()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t now = GetClockMs();
+        for (auto& inst : instances_)
+        {
+            switch (inst.state)
+            {
+            case COLD:
+                if (now >= inst.restart_at)
+                {
+                    StartSimulator(&inst);
+                }
+                break;
+            case STARTING:
+                if (!IsRunning(&inst))
+                {
+                    Fail(&inst, "the simulator exited");
+                }
+                else if (IsListening(inst.lane.simulator_port))
+                {
+                    StartAgents(&inst);
+                }
+                else if (now - inst.since > START_TIMEOUT_MS)
+                {
+                    Fail(&inst, "the simulator did not start in time");
+                }
+                break;
+            case WARMING:
+                if (!IsRunning(&inst))
+                {
+                    Fail(&inst, "a process exited while warming up");
+                }
+                else if (now - inst.since >= AGENT_WARMUP_MS)
+                {
+                    log_(LogLevel::INFO) << "Instance on slot "
+                        << inst.lane.index << " is warm.\n";
+                    inst.state = WARM;
+                    inst.since = now;
+                    inst.start_failures = 0;
+                    warmed_.notify_all();
+                }
+                break;
+            case WARM:
+                // Spares are also checked to still accept monitors, so a lane
+                // never takes an instance that has hung
+                if (!IsRunning(&inst))
+                {
+                    Fail(&inst, "a process exited");
+                }
+                else if (!inst.in_use && !IsListening(inst.lane.simulator_port))
+                {
+                    Fail(&inst, "the simulator stopped accepting monitors");
+                }
+                break;
+            case GIVEN_UP:
+                break;
+            }
+        }
+    }
+
+    bool InstancePool::IsAlive()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& inst : instances_)
+        {
+            if (inst.state != GIVEN_UP)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void InstancePool::StartSimulator(Instance* inst)
+    {
+        std::string path = "logs/simulator" + std::to_string(inst->lane.index)
+            + ".log";
+        inst->simulator = Spawn(Expand(config_.simulator_command, inst->lane, 0),
+                                path);
+        inst->state = STARTING;
+        inst->since = GetClockMs();
+        if (inst->simulator < 0)
+        {
+            Fail(inst, "the simulator could not be started");
+        }
+    }
+
+    void InstancePool::StartAgents(Instance* inst)
+    {
+        for (int player = 1; player <= config_.num_agents
+                             && !config_.agent_command.empty(); ++player)
+        {
+            std::string path = "logs/agent" + std::to_string(inst->lane.index)
+                + "_" + std::to_string(player) + ".log";
+            pid_t pg = Spawn(Expand(config_.agent_command, inst->lane, player),
+                             path);
+            if (pg < 0)
+            {
+                Fail(inst, "an agent could not be started");
+                return;
+            }
+            inst->agents.push_back(pg);
+        }
+        inst->state = WARMING;
+        inst->since = GetClockMs();
+    }
+
+    void InstancePool::Fail(Instance* inst, const std::string& reason)
+    {
+        log_(LogLevel::WARNING) << "Instance on slot " << inst->lane.index
+                                << " failed: " << reason << ".\n";
+
+        std::vector<pid_t> groups = inst->agents;
+        if (inst->simulator > 0)
+        {
+            groups.push_back(inst->simulator);
+        }
+        for (pid_t pg : groups)
+        {
+            kill(-pg, SIGKILL);
+            waitpid(pg, nullptr, 0);
+        }
+        inst->simulator = -1;
+        inst->agents.clear();
+
+        if (inst->state != WARM && ++inst->start_failures >= MAX_START_FAILURES)
+        {
+            log_(LogLevel::ERROR) << "Instance on slot " << inst->lane.index
+                << " failed to start " << inst->start_failures
+                << " times. Giving up on it.\n";
+            inst->state = GIVEN_UP;
+            warmed_.notify_all();
+            return;
+        }
+        inst->state = COLD;
+        inst->restart_at = GetClockMs() + RESTART_DELAY_MS;
+    }
+
+    bool InstancePool::IsRunning(Instance* inst)
+    {
+        // A process that has exited is reaped here, and its group marked
+        // gone, so Fail() does not wait for it again
+        bool running = true;
+        if (inst->simulator > 0 && waitpid(inst->simulator, nullptr, WNOHANG) != 0)
+        {
+            inst->simulator = -1;
+            running = false;
+        }
+        for (auto itr = inst->agents.begin(); itr != inst->agents.end();)
+        {
+            if (waitpid(*itr, nullptr, WNOHANG) != 0)
+            {
+                kill(-*itr, SIGKILL);
+                itr = inst->agents.erase(itr);
+                running = false;
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+        return running && inst->simulator > 0;
+    }
+
+    pid_t InstancePool::Spawn(const std::string& command,
+                              const std::string& log_path)
+    {
+        long max_fd = sysconf(_SC_OPEN_MAX);
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            return -1;
+        }
+
+        if (pid == 0)
+        {
+            // Other threads may have held locks at the fork, so only
+            // async-signal-safe calls until exec. Inherited descriptors are
+            // closed, so the process cannot keep a lane's ports bound.
+            setpgid(0, 0);
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            int in = open("/dev/null", O_RDONLY);
+            int out = open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            dup2(in, STDIN_FILENO);
+            dup2(out, STDOUT_FILENO);
+            dup2(out, STDERR_FILENO);
+            for (long fd = STDERR_FILENO + 1; fd < max_fd; ++fd)
+            {
+                close(fd);
+            }
+            execl("/bin/sh", "sh", "-c", command.c_str(), (char*) nullptr);
+            _exit(127);
+        }
+
+        setpgid(pid, pid);
+        return pid;
+    }
+
+    std::string InstancePool::Expand(std::string command, const Lane& lane,
+                                     const int player)
+    {
+        const std::pair<std::string, int> values[] = {
+            {"{slot}", lane.index},
+            {"{monitor_port}", lane.simulator_port},
+            {"{simulator_agent_port}", lane.simulator_agent_port},
+            {"{agent_port}", lane.agent_port},
+            {"{datagram_port}", lane.datagram_port},
+            {"{player}", player}
+        };
+        for (const auto& v : values)
+        {
+            size_t pos;
+            while ((pos = command.find(v.first)) != std::string::npos)
+            {
+                command.replace(pos, v.first.size(), std::to_string(v.second));
+            }
+        }
+        return command;
+    }
+
+    bool InstancePool::IsListening(const int port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bool result = connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                              sizeof(addr)) == 0;
+        close(fd);
+        return result;
+    }
+
+    int64_t InstancePool::GetClockMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
@@ -0,0 +1,15 @@
+#include "Lane.h"
+#include "RoboCupGameControlData.hpp"
+
+namespace findballexp
+{
+    Lane Lane::Make(const int index)
+    {
+        std::string suffix = index == 0 ? "" : std::to_string(index);
+        int offset = index * PORT_STRIDE;
+        return Lane{index, 3200 + offset, 3100 + offset, 3232 + offset, 
+                    GAMECONTROLLER_RETURN_PORT + offset,
+                    "/tmp/findballexp" + suffix + ".sock", 
+                    "/findballexp" + suffix};
+    }
+}
@@ -0,0 +1,99 @@
+#include "ResultWriter.h"
+
+namespace findballexp
+{
+    ResultWriter::ResultWriter()
+        : next_{1}
+    { }
+
+    ResultWriter::~ResultWriter()
+    {
+        Close();
+    }
+
+    bool ResultWriter::Open(const std::string& prefix, const int first_test)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        next_ = first_test;
+        bool result = true;
+
+        std::string name = prefix + "_test.csv";
+        tests_file_.open(name, std::ofstream::out);
+        if (tests_file_.is_open())
+        {
+            log_(LogLevel::INFO) << "Opened tests output file '" << name << "'\n";
+            tests_file_ << "Test,BallX,BallY,Robots,Seconds,FoundBy\n";
+        }
+        else
+        {
+            log_(LogLevel::WARNING) << "Could not open tests output file '" 
+                << name << "'\n";
+            result = false;
+        }
+
+        name = prefix + "_pos.csv";
+        pos_file_.open(name, std::ofstream::out);
+        if (pos_file_.is_open())
+        {
+            log_(LogLevel::INFO) << "Opened positions output file '" 
+                << name << "'\n";
+            pos_file_ 
+                << "Test,Seconds,Robot1Pos,Robot2Pos,Robot3Pos,Robot4Pos,Robot5Pos,BallPos\n";
+        }
+        else
+        {
+            log_(LogLevel::WARNING) << "Could not open positions output file '" 
+                << name << "'\n";
+            result = false;
+        }
+        return result;
+    }
+
+    void ResultWriter::Write(const int test, const std::string& test_row, 
+                             const std::string& pos_rows)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (test > next_)
+        {
+            held_[test] = std::make_pair(test_row, pos_rows);
+            return;
+        }
+
+        WriteRows(test_row, pos_rows);
+        if (test < next_)
+        {
+            return;
+        }
+
+        // Write every held test that was waiting on this one
+        ++next_;
+        auto itr = held_.begin();
+        while (itr != held_.end() && itr->first == next_)
+        {
+            WriteRows(itr->second.first, itr->second.second);
+            next_ = itr->first + 1;
+            itr = held_.erase(itr);
+        }
+    }
+
+    void ResultWriter::Close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& h : held_)
+        {
+            WriteRows(h.second.first, h.second.second);
+        }
+        held_.clear();
+        tests_file_.close();
+        pos_file_.close();
+    }
+
+    void ResultWriter::WriteRows(const std::string& test_row, 
+                                 const std::string& pos_rows)
+    {
+        tests_file_ << test_row;
+        pos_file_ << pos_rows;
+        tests_file_.flush();
+        pos_file_.flush();
+    }
+}
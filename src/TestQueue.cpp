@@ -0,0 +1,31 @@
+#include "TestQueue.h"
+
+namespace findballexp
+{
+    TestQueue::TestQueue(const int first, const int count)
+        : end_{count < 0 ? -1 : first + count}, next_{first}
+    { }
+
+    bool TestQueue::Next(int* index)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!requeued_.empty())
+        {
+            *index = *requeued_.begin();
+            requeued_.erase(requeued_.begin());
+            return true;
+        }
+        if (end_ >= 0 && next_ >= end_)
+        {
+            return false;
+        }
+        *index = next_++;
+        return true;
+    }
+
+    void TestQueue::Requeue(const int index)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requeued_.insert(index);
+    }
+}
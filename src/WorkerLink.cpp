@@ -0,0 +1,94 @@
+#include "WorkerLink.h"
+#include "utils/ThreadSafeLogger.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace librcsscontroller;
+
+namespace findballexp
+{
+    /**
+     *  Returns the monotonic clock in milliseconds.
+     */
+    static int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    WorkerLink::WorkerLink(const int fd)
+        : fd_{fd}, last_heartbeat_{0}
+    { }
+
+    WorkerLink::~WorkerLink()
+    {
+        close(fd_);
+    }
+
+    bool WorkerLink::Next(int* index)
+    {
+        if (!Send("N"))
+        {
+            return false;
+        }
+
+        char reply[32];
+        ssize_t n;
+        do
+        {
+            n = recv(fd_, reply, sizeof(reply) - 1, 0);
+        } while (n < 0 && errno == EINTR);
+
+        if (n <= 1 || reply[0] != 'T')
+        {
+            return false;
+        }
+        reply[n] = '\0';
+        *index = std::atoi(reply + 1);
+        return true;
+    }
+
+    void WorkerLink::Requeue(const int index)
+    {
+        Send("Q" + std::to_string(index));
+    }
+
+    void WorkerLink::Write(const int test, const std::string& test_row, 
+                           const std::string& pos_rows)
+    {
+        std::string msg = "W" + std::to_string(test) + " " 
+            + std::to_string(test_row.size()) + "\n";
+        msg += test_row;
+        msg += pos_rows;
+        if (!Send(msg))
+        {
+            ThreadSafeLogger()(LogLevel::ERROR) 
+                << "Error sending results of test no. " << test 
+                << " to the coordinator.\n";
+        }
+    }
+
+    void WorkerLink::Heartbeat()
+    {
+        int64_t now = now_ms();
+        if (now - last_heartbeat_ >= HEARTBEAT_INTERVAL_MS)
+        {
+            last_heartbeat_ = now;
+            Send("H");
+        }
+    }
+
+    bool WorkerLink::Send(const std::string& msg)
+    {
+        ssize_t n;
+        do
+        {
+            n = send(fd_, msg.data(), msg.size(), MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        return n == static_cast<ssize_t>(msg.size());
+    }
+}
@@ -1 +1 @@
-export LD_LIBRARY_PATH=../lib/; ./findballexp $1
\ No newline at end of file
+export LD_LIBRARY_PATH=../lib/; ./findballexp $1 $2 $3 $4 $5 $6
\ No newline at end of file